@@ -14,13 +14,14 @@
 struct queue
 {
 	int count, head, tail;
-	struct process *wait;
+	struct wait_queue wait;
 	char *buffer;
 };
 
 extern char fonts[];
 int x, y;
 struct queue read_queue;
+int con_lock = 0;
 int sum_char_x[NR_CHAR_Y];
 char digits_map[] = "0123456789abcdef";
 char keys_map[] = {
@@ -82,10 +83,8 @@ void scrup()
 
 	to = (char *)VRAM_BASE;
 	from = (char *)(VRAM_BASE + (CHAR_HEIGHT * NR_PIX_X * NR_BYTE_PIX));
-	for (i = 0; i < (NR_PIX_Y - CHAR_HEIGHT) * NR_PIX_X * NR_BYTE_PIX; i++, to++, from++)
-		*to = *from;
-	for (i = 0; i < NR_CHAR_X; i++)
-		erase_char(i, NR_CHAR_Y - 1);
+	copy_mem(to, from, (NR_PIX_Y - CHAR_HEIGHT) * NR_PIX_X * NR_BYTE_PIX);
+	set_mem(to + (NR_PIX_Y - CHAR_HEIGHT) * NR_PIX_X * NR_BYTE_PIX, 0, CHAR_HEIGHT * NR_PIX_X * NR_BYTE_PIX);
 	for (i = 0; i < NR_CHAR_Y - 1; i++)
 		sum_char_x[i] = sum_char_x[i + 1];
 	sum_char_x[i] = 0;
@@ -120,6 +119,7 @@ void printk(char *buf)
 
 	while (buf[nr] != '\0')
 		nr++;
+	spin_lock(&con_lock);
 	erase_char(x, y);
 	while (nr--)
 	{
@@ -140,9 +140,11 @@ void printk(char *buf)
 			panic("panic: unsurpported char!\n");
 	}
 	write_char('_', x, y);
+	spin_unlock(&con_lock);
 }
 void panic(char *s)
 {
+	spin_unlock(&con_lock);
 	printk(s);
 	while (1)
 		;
@@ -168,11 +170,16 @@ void put_queue(char c)
 {
 	if (!c)
 		return;
+	spin_lock(&con_lock);
 	if (read_queue.count == BUFFER_SIZE)
+	{
+		spin_unlock(&con_lock);
 		return;
+	}
 	read_queue.buffer[read_queue.head] = c;
 	read_queue.head = (read_queue.head + 1) & (BUFFER_SIZE - 1);
 	read_queue.count++;
+	spin_unlock(&con_lock);
 	wake_up(&read_queue.wait);
 }
 int sys_output(char *buf)
@@ -180,15 +187,30 @@ int sys_output(char *buf)
 	printk(buf);
 	return 0;
 }
-int sys_input(char *buf)
+int con_read(char *buf, int nonblock)
 {
-	if (read_queue.count == 0)
-		sleep_on(&read_queue.wait);
-	*buf = read_queue.buffer[read_queue.tail];
+	char c;
+
+	spin_lock(&con_lock);
+	while (read_queue.count == 0)
+	{
+		spin_unlock(&con_lock);
+		if (nonblock)
+			return -1;
+		sleep_on_exclusive(&read_queue.wait);
+		spin_lock(&con_lock);
+	}
+	c = read_queue.buffer[read_queue.tail];
 	read_queue.tail = ((read_queue.tail) + 1) & (BUFFER_SIZE - 1);
 	read_queue.count--;
+	spin_unlock(&con_lock);
+	*buf = c;
 	return 0;
 }
+int sys_input(char *buf)
+{
+	return con_read(buf, 0);
+}
 void keyboard_interrupt()
 {
 	unsigned char c;
@@ -206,9 +228,12 @@ void con_init()
 	read_queue.count = 0;
 	read_queue.head = 0;
 	read_queue.tail = 0;
-	read_queue.wait = 0;
-	read_queue.buffer = (char *)get_page(1);
+	read_queue.buffer = (char *)get_page(1, GFP_NOZERO);
 
 	x = 0;
 	y = 0;
-}
\ No newline at end of file
+}
+void con_stats()
+{
+	wait_queue_stats("console input", &read_queue.wait);
+}
@@ -34,23 +34,33 @@ struct buffer
 struct request
 {
 	int update;
-	struct process *wait;
+	struct wait_queue wait;
 };
 
 struct buffer buffer_table[NR_BUFFER];
+struct kmem_cache *buffer_cache;
 struct request request;
+int disk_spin = 0;
 int disk_lock = 0;
-struct process *disk_wait = 0;
+struct wait_queue disk_wait;
 
 void lock_disk()
 {
+	spin_lock(&disk_spin);
 	while (disk_lock)
-		sleep_on(&disk_wait);
+	{
+		spin_unlock(&disk_spin);
+		sleep_on_exclusive(&disk_wait);
+		spin_lock(&disk_spin);
+	}
 	disk_lock = 1;
+	spin_unlock(&disk_spin);
 }
 void unlock_disk()
 {
+	spin_lock(&disk_spin);
 	disk_lock = 0;
+	spin_unlock(&disk_spin);
 	wake_up(&disk_wait);
 }
 void rw_disk(unsigned short blocknr, char *buf, int rw)
@@ -73,6 +83,23 @@ void rw_disk_block(int rw, short blocknr, char *buf)
 	if (!request.update)
 		sleep_on(&request.wait);
 }
+void rw_disk_blocks(int rw, short blocknr, char *buf, int nr)
+{
+	int i;
+
+	lock_disk();
+	for (i = 0; i < nr; i++)
+		rw_disk_block(rw, blocknr + i, buf + i * BLOCK_SIZE);
+	unlock_disk();
+}
+void read_blocks(short blocknr, char *buf, int nr)
+{
+	rw_disk_blocks(READ, blocknr, buf, nr);
+}
+void write_blocks(short blocknr, char *buf, int nr)
+{
+	rw_disk_blocks(WRITE, blocknr, buf, nr);
+}
 struct buffer *find_buffer(short blocknr)
 {
 	int i;
@@ -133,15 +160,13 @@ char *read_block(short blocknr)
 }
 void disk_init()
 {
-	char *block_data = 0;
 	int i;
 
-	for (i = 0; i < NR_BUFFER; i++, block_data += BLOCK_SIZE)
+	buffer_cache = kmem_cache_create("buffer", BLOCK_SIZE, 0, 0);
+	for (i = 0; i < NR_BUFFER; i++)
 	{
 		buffer_table[i].blocknr = -1;
-		if (i % 8 == 0)
-			block_data = (char *)get_page(1);
-		buffer_table[i].data = block_data;
+		buffer_table[i].data = (char *)kmem_cache_alloc(buffer_cache);
 	}
 	*(unsigned int *)(HBA_PORT0_CMD) |= HBA_PORT0_CMD_FRE;
 	*(unsigned int *)(HBA_PORT0_CMD) |= HBA_PORT0_CMD_ST;
@@ -161,3 +186,8 @@ int sys_sync()
 	unlock_disk();
 	return 0;
 }
+void disk_stats()
+{
+	wait_queue_stats("disk lock", &disk_wait);
+	wait_queue_stats("disk request", &request.wait);
+}
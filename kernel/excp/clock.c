@@ -0,0 +1,135 @@
+#include <xtos.h>
+
+#define CSR_PRMD 0x1
+#define CSR_TCFG 0x41
+#define CSR_TICLR 0x44
+#define CSR_PRMD_PPLV (3UL << 0)
+#define CSR_TCFG_EN (1UL << 0)
+#define CSR_TICLR_CLR (1UL << 0)
+#define CC_FREQ 4
+#define HZ 100
+#define MIN_DELTA 4
+
+unsigned long cycles_per_tick;
+struct timer *timer_list = 0;
+int timer_lock = 0;
+
+void program_timer()
+{
+	unsigned long next, now, delta;
+
+	next = this_cpu()->slice_end;
+	if (timer_list && (!next || timer_list->expires < next))
+		next = timer_list->expires;
+	if (!next)
+	{
+		write_csr_64(0, CSR_TCFG);
+		return;
+	}
+	now = get_cycles();
+	delta = next > now + MIN_DELTA ? next - now : MIN_DELTA;
+	write_csr_64((delta & ~3UL) | CSR_TCFG_EN, CSR_TCFG);
+}
+void add_timer(struct timer *timer)
+{
+	struct timer **link;
+
+	spin_lock(&timer_lock);
+	for (link = &timer_list; *link && (*link)->expires <= timer->expires; link = &(*link)->next)
+		;
+	timer->next = *link;
+	*link = timer;
+	spin_unlock(&timer_lock);
+	program_timer();
+}
+void run_timers(unsigned long now)
+{
+	struct timer *timer;
+
+	spin_lock(&timer_lock);
+	while (timer_list && timer_list->expires <= now)
+	{
+		timer = timer_list;
+		timer_list = timer->next;
+		wake_process(timer->p);
+	}
+	spin_unlock(&timer_lock);
+}
+void switch_slice(struct process *prev, struct process *next)
+{
+	struct cpu *cpu;
+	unsigned long now;
+
+	cpu = this_cpu();
+	now = get_cycles();
+	prev->stime += now - cpu->account_stamp;
+	cpu->account_stamp = now;
+	if (prev->pid && cpu->slice_end)
+		prev->counter = cpu->slice_end > now ? (cpu->slice_end - now + cycles_per_tick - 1) / cycles_per_tick : 0;
+	cpu->slice_end = next->pid ? now + next->counter * cycles_per_tick : 0;
+	cpu->need_resched = 0;
+	program_timer();
+}
+void account_user()
+{
+	struct cpu *cpu;
+	unsigned long now;
+
+	cpu = this_cpu();
+	now = get_cycles();
+	cpu->curr->utime += now - cpu->account_stamp;
+	cpu->account_stamp = now;
+}
+void account_system()
+{
+	struct cpu *cpu;
+	unsigned long now;
+
+	cpu = this_cpu();
+	now = get_cycles();
+	cpu->curr->stime += now - cpu->account_stamp;
+	cpu->account_stamp = now;
+}
+void timer_interrupt()
+{
+	struct cpu *cpu;
+	unsigned long now;
+
+	write_csr_32(CSR_TICLR_CLR, CSR_TICLR);
+	cpu = this_cpu();
+	now = get_cycles();
+	run_timers(now);
+	if (cpu->slice_end && now >= cpu->slice_end)
+	{
+		cpu->curr->counter = 0;
+		cpu->slice_end = 0;
+		cpu->need_resched = 1;
+	}
+	program_timer();
+}
+void check_resched()
+{
+	if (this_cpu()->need_resched && (read_csr_32(CSR_PRMD) & CSR_PRMD_PPLV))
+		schedule();
+}
+int sys_sleep(int ticks)
+{
+	struct timer timer;
+
+	if (ticks <= 0)
+		return 0;
+	timer.expires = get_cycles() + ticks * cycles_per_tick;
+	timer.p = current;
+	add_timer(&timer);
+	current->state = TASK_UNINTERRUPTIBLE;
+	dequeue_task(current);
+	schedule();
+	return 0;
+}
+void clock_init()
+{
+	cycles_per_tick = read_cpucfg(CC_FREQ) / HZ;
+	this_cpu()->account_stamp = get_cycles();
+	this_cpu()->slice_end = 0;
+	program_timer();
+}
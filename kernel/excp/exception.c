@@ -5,55 +5,64 @@
 #define CSR_PRMD 0x1
 #define CSR_ECFG 0x4
 #define CSR_ESTAT 0x5
+#define CSR_BADV 0x7
 #define CSR_EENTRY 0xc
-#define CSR_TCFG 0x41
-#define CSR_TICLR 0x44
 #define CSR_TLBRENTRY 0x88
 #define CSR_CRMD_IE (1UL << 2)
 #define CSR_PRMD_PPLV (3UL << 0)
-#define CSR_TCFG_EN (1UL << 0)
-#define CSR_TCFG_PER (1UL << 1)
-#define CSR_TICLR_CLR (1UL << 0)
 #define CSR_ECFG_LIE_TI (1UL << 11)
 #define CSR_ECFG_LIE_HWI0 (1UL << 2)
 #define CSR_ESTAT_IS_TI (1UL << 11)
 #define CSR_ESTAT_IS_HWI0 (1UL << 2)
-#define CC_FREQ 4
+#define CSR_ESTAT_IS_IPI (1UL << 12)
+#define CSR_ECFG_LIE_IPI (1UL << 12)
+#define CSR_ESTAT_ECODE (0x3fUL << 16)
 #define L7A_SPACE_BASE (0x10000000UL | DMW_MASK)
 #define L7A_INT_MASK (L7A_SPACE_BASE + 0x020)
 #define L7A_HTMSI_VEC (L7A_SPACE_BASE + 0x200)
 #define IOCSR_EXT_IOI_EN 0x1600
 #define IOCSR_EXT_IOI_SR 0x1800
+#define SYSCALL_SLOW 0x1
+#define SYSCALL_EXEC 0x2
 #define KEYBOARD_IRQ 3
 #define SATA_IRQ 19
 #define KEYBOARD_IRQ_HT 0
 #define SATA_IRQ_HT 1
 
-extern struct process *current;
 int (*syscalls[])() = {
 	sys_fork, sys_input, sys_output, sys_exit, sys_pause,
-	sys_mount, sys_exe};
+	sys_mount, (int (*)())sys_exe, (int (*)())sys_brk, (int (*)())sys_mmap,
+	sys_munmap, (int (*)())sys_shmat, sys_shmdt, sys_futex_wait, sys_futex_wake,
+	sys_nice, sys_times, sys_sleep, sys_wait, sys_spawn,
+	(int (*)())sys_ring_setup, sys_ring_enter, sys_stats};
+int nr_syscalls = sizeof(syscalls) / sizeof(syscalls[0]);
+char syscall_flags[sizeof(syscalls) / sizeof(syscalls[0])] = {
+	SYSCALL_SLOW, 0, 0, 0, 0, 0, SYSCALL_SLOW | SYSCALL_EXEC};
 
-void timer_interrupt()
-{
-	if ((--current->counter) > 0)
-		return;
-	current->counter = 0;
-	if ((read_csr_32(CSR_PRMD) & CSR_PRMD_PPLV) == 0)
-		return;
-	schedule();
-}
 void do_exception()
 {
 	unsigned int estat;
 	unsigned long irq;
+	int ecode;
 
 	estat = read_csr_32(CSR_ESTAT);
-	if (estat & CSR_ESTAT_IS_TI)
+	ecode = (estat & CSR_ESTAT_ECODE) >> 16;
+	if (ecode >= EXCP_PIL && ecode <= EXCP_PPI)
 	{
-		timer_interrupt();
-		write_csr_32(CSR_TICLR_CLR, CSR_TICLR);
+		do_page_fault(read_csr_64(CSR_BADV), ecode);
+		return;
+	}
+	if (ecode >= EXCP_FPD && ecode <= EXCP_ASXD)
+	{
+		if (!(read_csr_32(CSR_PRMD) & CSR_PRMD_PPLV))
+			panic("panic: simd used in kernel!\n");
+		do_fpu_disabled(ecode);
+		return;
 	}
+	if (estat & CSR_ESTAT_IS_IPI)
+		handle_ipi();
+	if (estat & CSR_ESTAT_IS_TI)
+		timer_interrupt();
 	if (estat & CSR_ESTAT_IS_HWI0)
 	{
 		irq = read_iocsr(IOCSR_EXT_IOI_SR);
@@ -68,6 +77,7 @@ void do_exception()
 			write_iocsr(1UL << SATA_IRQ_HT, IOCSR_EXT_IOI_SR);
 		}
 	}
+	check_resched();
 }
 void int_on()
 {
@@ -76,17 +86,18 @@ void int_on()
 	crmd = read_csr_32(CSR_CRMD);
 	write_csr_32(crmd | CSR_CRMD_IE, CSR_CRMD);
 }
-void excp_init()
+void excp_init_cpu()
 {
-	unsigned int val;
-
-	val = read_cpucfg(CC_FREQ);
-	write_csr_64((unsigned long)val | CSR_TCFG_EN | CSR_TCFG_PER, CSR_TCFG);
+	clock_init();
 	write_csr_64((unsigned long)exception_handler, CSR_EENTRY);
 	write_csr_64((unsigned long)tlb_handler, CSR_TLBRENTRY);
+	write_csr_32(CSR_ECFG_LIE_TI | CSR_ECFG_LIE_HWI0 | CSR_ECFG_LIE_IPI, CSR_ECFG);
+}
+void excp_init()
+{
+	excp_init_cpu();
 	*(volatile unsigned long *)(L7A_INT_MASK) = ~(0x1UL << KEYBOARD_IRQ | 0x1UL << SATA_IRQ);
 	*(volatile unsigned char *)(L7A_HTMSI_VEC + KEYBOARD_IRQ) = KEYBOARD_IRQ_HT;
 	*(volatile unsigned char *)(L7A_HTMSI_VEC + SATA_IRQ) = SATA_IRQ_HT;
 	write_iocsr((0x1UL << KEYBOARD_IRQ_HT | 0x1UL << SATA_IRQ_HT), IOCSR_EXT_IOI_EN);
-	write_csr_32(CSR_ECFG_LIE_TI | CSR_ECFG_LIE_HWI0, CSR_ECFG);
-}
\ No newline at end of file
+}
@@ -1,13 +1,61 @@
 #define DMW_MASK 0x9000000000000000UL
 #define PAGE_SIZE 4096
-#define VMEM_SIZE (1UL << (9 + 9 + 12))
+#define HUGE_PAGE_SIZE (1UL << 21)
+#define HUGE_PAGE_NR (HUGE_PAGE_SIZE / PAGE_SIZE)
+#define MAP_HUGE 0x1
+#define VM_HUGE 0x1
+#if PT_LEVELS < 2 || PT_LEVELS > 4
+#error "PT_LEVELS must be 2, 3 or 4"
+#endif
+#define VA_BITS (9 * PT_LEVELS + 12 < 47 ? 9 * PT_LEVELS + 12 : 47)
+#define VMEM_SIZE (1UL << VA_BITS)
+#define USTACK_SIZE (8UL << 20)
+#define MMAP_BASE (VMEM_SIZE - USTACK_SIZE)
 #define BLOCK_SIZE 512
 #define NAME_LEN 9
-#define NR_PROCESS 64
+#define PID_MAX 32768
+#define SWAP_START 4096
+#define RING_OP_OUTPUT 0
+#define RING_OP_INPUT 1
+#define RING_OP_READ 2
+#define RING_OP_SPAWN 3
+#define NR_PRIO 8
+#define NR_CPU 4
+#define CSR_CPUID 0x20
+#define IPI_BOOT 0
+#define IPI_RESCHED 1
+#define IPI_TLB 2
+#define MEM_FAST_MIN 32
 #define TASK_RUNNING 0
 #define TASK_UNINTERRUPTIBLE 1
 #define TASK_INTERRUPTIBLE 2
 #define TASK_EXIT 3
+#define PAGE_RESERVED (1 << 0)
+#define PAGE_BUDDY (1 << 1)
+#define PAGE_HEAD (1 << 2)
+#define PAGE_CACHED (1 << 3)
+#define GFP_NOZERO (1 << 0)
+#define GFP_TRY (1 << 1)
+#define PTE_V (1UL << 0)
+#define PTE_D (1UL << 1)
+#define PTE_PLV (3UL << 2)
+#define PTE_HUGE (1UL << 6)
+#define PTE_W (1UL << 8)
+#define PTE_SWAP (1UL << 9)
+#define PTE_SHARED (1UL << 10)
+#define EXCP_PIL 0x1
+#define EXCP_PIS 0x2
+#define EXCP_PIF 0x3
+#define EXCP_PME 0x4
+#define EXCP_PPI 0x7
+#define EXCP_FPD 0xf
+#define EXCP_SXD 0x10
+#define EXCP_ASXD 0x11
+#define CSR_EUEN 0x2
+#define CSR_EUEN_FPE (1U << 0)
+#define CSR_EUEN_SXE (1U << 1)
+#define CSR_EUEN_ASXE (1U << 2)
+#define FPU_ALIGN 32
 
 struct context
 {
@@ -15,19 +63,119 @@ struct context
 	unsigned long s0, s1, s2, s3, s4, s5, s6, s7, s8, fp;
 	unsigned long csr_save0;
 };
+struct fpu_state
+{
+	unsigned long regs[32][4];
+	unsigned char fcc[8];
+	unsigned int fcsr;
+};
 struct process
 {
 	int state;
 	int pid;
 	int counter;
-	int signal_exit;
+	int exit_code;
+	int prio;
+	int cpu;
+	int lock_depth;
+	int nice, level;
+	unsigned long utime, stime;
 	unsigned long exe_end;
+	unsigned long start_brk, brk;
 	unsigned long page_directory;
+	unsigned long kstack;
+	unsigned long asid;
 	struct inode *executable;
+	struct vm_area *mmap;
 	struct process *father;
-	struct process *wait_next;
+	struct process *children, *zombies;
+	struct process *sibling_next, *sibling_prev;
+	struct process *hash_next;
+	struct run_queue *rq;
+	struct process *run_next, *run_prev;
+	struct fpu_state *fpu;
+	unsigned int fpu_euen;
+	unsigned long ring_sq, ring_cq;
 	struct context context;
 };
+struct wait_entry
+{
+	struct process *p;
+	int exclusive;
+	struct wait_entry *next;
+};
+struct wait_queue
+{
+	int lock;
+	struct wait_entry *head, *tail;
+	unsigned long nr_sleep, nr_wake;
+	unsigned long wait_time, max_wait;
+};
+struct run_queue
+{
+	unsigned int bitmap;
+	struct process *head[NR_PRIO], *tail[NR_PRIO];
+};
+struct cpu
+{
+	int id;
+	int online;
+	struct process *curr;
+	struct process *idle;
+	struct process *fpu_owner;
+	struct run_queue queues[2];
+	struct run_queue *active, *expired;
+	int rq_lock;
+	int nr_running;
+	int need_resched;
+	unsigned long slice_end;
+	unsigned long account_stamp;
+	unsigned long asid_next;
+	volatile int flush_pending;
+	unsigned long flush_asid, flush_va;
+};
+struct vm_area
+{
+	unsigned long start, end;
+	unsigned long attr;
+	struct inode *inode;
+	unsigned long offset;
+	struct shm *shm;
+	int flags;
+	struct vm_area *next;
+};
+struct page
+{
+	unsigned char order;
+	unsigned char flags;
+	unsigned short count;
+	unsigned short used;
+};
+struct magazine
+{
+	int count;
+	int low, high, batch;
+	unsigned long hit, miss;
+};
+struct kmem_cache
+{
+	char *name;
+	int size, stride;
+	int free_offset, slab_offset;
+	int order, nr_objs;
+	void (*ctor)(void *);
+	struct slab *partial, *full, *empty;
+	int nr_empty;
+	int lock;
+	unsigned long nr_slabs, nr_active;
+	unsigned long nr_alloc, nr_free;
+};
+struct timer
+{
+	unsigned long expires;
+	struct process *p;
+	struct timer *next;
+};
 struct inode
 {
 	int size;
@@ -41,6 +189,7 @@ void panic(char *);
 void print_debug(char *, unsigned long);
 void keyboard_interrupt();
 int sys_output(char *);
+int con_read(char *, int);
 int sys_input(char *);
 
 void excp_init();
@@ -48,40 +197,160 @@ void int_on();
 void exception_handler();
 void tlb_handler();
 void fork_ret();
+void cpu_idle();
+
+extern unsigned long cycles_per_tick;
+void clock_init();
+void account_user();
+void account_system();
+void timer_interrupt();
+void check_resched();
+void add_timer(struct timer *);
+void switch_slice(struct process *, struct process *);
+int sys_sleep(int);
+
+extern struct page *mem_map;
+extern unsigned long nr_page;
 
 void mem_init();
-unsigned long get_page(int size);
+unsigned long get_page(int size, int flags);
+unsigned long nr_free_pages();
+int zero_page_idle();
 void free_page(unsigned long);
 void put_page(struct process *, unsigned long, unsigned long, unsigned long);
+void put_huge_page(struct process *, unsigned long, unsigned long, unsigned long);
 void copy_page_table(struct process *, struct process *);
+void share_page(unsigned long);
+void switch_mm(struct process *);
+void flush_tlb_mm(struct process *);
+void flush_tlb_page(struct process *, unsigned long);
+unsigned long *find_pte(struct process *, unsigned long);
+void do_page_fault(unsigned long, int);
+void bad_area(unsigned long);
+
+struct vm_area *find_vma(struct process *, unsigned long);
+struct vm_area *insert_vma(struct process *, unsigned long, unsigned long, unsigned long, struct inode *, unsigned long);
+void copy_vmas(struct process *, struct process *);
+void free_vmas(struct process *);
 void free_page_table(struct process *);
+void unmap_page(struct process *, unsigned long);
+void unmap_range(struct process *, unsigned long, unsigned long);
+int map_area(struct process *, unsigned long, unsigned long, unsigned long, int);
+void unmap_area(struct process *, unsigned long, unsigned long);
+unsigned long get_unmapped_area(struct process *, unsigned long, unsigned long);
+unsigned long sys_brk(unsigned long);
+unsigned long sys_mmap(unsigned long, int);
+int sys_munmap(unsigned long, unsigned long);
+
+extern struct cpu cpus[NR_CPU];
+extern int nr_cpu_online;
+void smp_init();
+void start_secondary();
+void send_ipi(int, int);
+void handle_ipi();
+void tlb_shootdown(int, unsigned long, unsigned long);
+void do_tlb_shootdown();
+void lock_kernel();
+void unlock_kernel();
+void idle_cpu();
+void excp_init_cpu();
+void mmu_init();
 
 void process_init();
+void idle_loop();
 void schedule();
 int sys_fork();
-int sys_exit();
+int sys_exit(int);
+int sys_wait(int, int *);
+int sys_spawn(char *, char *);
+unsigned long sys_ring_setup();
+int sys_ring_enter(int, int);
+void free_ring(struct process *);
 int sys_pause();
-int sys_exe(char *, char *);
-void sleep_on(struct process **);
-void wake_up(struct process **);
+int sys_nice(int);
+int sys_times(unsigned long *);
+int sys_stats(int);
+unsigned long sys_exe(char *, char *);
+void sleep_on(struct wait_queue *);
+void sleep_on_exclusive(struct wait_queue *);
+int __wake_up(struct wait_queue *, int);
+void wake_up(struct wait_queue *);
+void wake_up_all(struct wait_queue *);
+void wait_queue_stats(char *, struct wait_queue *);
+void disk_stats();
+void swap_stats();
+void con_stats();
+void futex_stats();
+void wake_process(struct process *);
+void activate_task(struct process *);
+void enqueue_task(struct process *);
+void dequeue_task(struct process *);
 void free_process(struct process *);
+void release_fpu();
+void switch_fpu(struct process *);
+void do_fpu_disabled(int);
+void copy_fpu(struct process *, struct process *);
+void free_fpu(struct process *);
+int alloc_pid();
+int next_pid(int);
+void attach_pid(struct process *);
+void detach_pid(struct process *);
+struct process *find_process(int);
 void swtch(struct context *, struct context *);
+void add_child(struct process *, struct process *);
 void tell_father();
-void do_signal();
+void get_shm(struct shm *);
+void put_shm(struct shm *);
+unsigned long sys_shmat(int, unsigned long);
+int sys_shmdt(unsigned long);
+int sys_futex_wait(int *, int);
+int sys_futex_wake(int *, int);
 
 void disk_interrupt();
 void disk_init();
 char *read_block(short);
 void write_block(short, char *);
+void read_blocks(short, char *, int);
+void write_blocks(short, char *, int);
 
 int sys_mount();
 struct inode *find_inode(char *);
 void read_inode_block(struct inode *, short, char *, int);
 
+// mem
+extern void (*set_mem_fast)(char *, int, int);
+extern void (*copy_mem_fast)(char *, char *, int);
+extern int (*match_fast)(char *, char *, int);
+void copy_mem_word(char *, char *, int);
+void mem_ops_init();
+void bench_mem();
+
 // buddy
 int get_page_buddy(int size);
-void free_buddy_page(int page);
+int free_buddy_page(int page);
 void init_buddy();
+void split_buddy_page(int page);
+extern unsigned long nr_buddy_free;
+void bench_buddy();
+
+// slab
+struct kmem_cache *kmem_cache_create(char *name, int size, int align, void (*ctor)(void *));
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+extern struct kmem_cache *buffer_cache;
+void slab_stats();
+
+// swap
+int reclaim_pages();
+void do_swap_page(unsigned long *, unsigned long);
+void dup_swap_entry(unsigned long);
+void free_swap_entry(unsigned long);
+
+// magazine
+extern struct magazine magazine;
+int get_page_magazine();
+void free_page_magazine(int page);
+void magazine_stats();
 
 static inline void write_csr_32(unsigned int val, unsigned int csr)
 {
@@ -128,6 +397,21 @@ static inline unsigned long read_iocsr(unsigned long reg)
 				 : "r"(reg));
 	return val;
 }
+static inline void write_iocsr_32(unsigned int val, unsigned long reg)
+{
+	asm volatile("iocsrwr.w %0, %1"
+				 :
+				 : "r"(val), "r"(reg));
+}
+static inline unsigned int read_iocsr_32(unsigned long reg)
+{
+	unsigned int val;
+
+	asm volatile("iocsrrd.w %0, %1"
+				 : "=r"(val)
+				 : "r"(reg));
+	return val;
+}
 static inline unsigned int read_cpucfg(int cfg_num)
 {
 	unsigned int val;
@@ -137,17 +421,62 @@ static inline unsigned int read_cpucfg(int cfg_num)
 				 : "r"(cfg_num));
 	return val;
 }
+static inline unsigned long get_cycles()
+{
+	unsigned long val;
+
+	asm volatile("rdtime.d %0, $r0"
+				 : "=r"(val));
+	return val;
+}
+static inline struct cpu *this_cpu()
+{
+	return &cpus[read_csr_32(CSR_CPUID) & 0x1ff];
+}
+#define current (this_cpu()->curr)
+static inline void spin_lock(int *lock)
+{
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+		while (*(volatile int *)lock)
+			;
+}
+static inline void spin_unlock(int *lock)
+{
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
 static inline void invalidate()
 {
 	asm volatile("invtlb 0x0,$r0,$r0");
 }
+static inline void invalidate_asid(unsigned long asid)
+{
+	asm volatile("invtlb 0x4, %0, $r0"
+				 :
+				 : "r"(asid));
+}
+static inline void invalidate_page(unsigned long asid, unsigned long u_vaddr)
+{
+	asm volatile("invtlb 0x5, %0, %1"
+				 :
+				 : "r"(asid), "r"(u_vaddr));
+}
 static inline void set_mem(char *to, int c, int nr)
 {
+	if (nr >= MEM_FAST_MIN)
+	{
+		set_mem_fast(to, c, nr);
+		return;
+	}
 	for (int i = 0; i < nr; i++)
 		to[i] = c;
 }
 static inline void copy_mem(char *to, char *from, int nr)
 {
+	if (nr >= MEM_FAST_MIN)
+	{
+		copy_mem_fast(to, from, nr);
+		return;
+	}
 	for (int i = 0; i < nr; i++)
 		to[i] = from[i];
 }
@@ -159,14 +488,22 @@ static inline void copy_string(char *to, char *from)
 		;
 	copy_mem(to, from, nr);
 }
+// 用户地址可能缺页，缺页处理本身会用SIMD清零或拷贝页面，
+// 打断中途的向量拷贝会破坏其寄存器，所以涉及用户内存的拷贝只走标量路径
+static inline void copy_user(char *to, char *from, int nr)
+{
+	copy_mem_word(to, from, nr);
+}
+static inline void copy_string_user(char *to, char *from, int max)
+{
+	int nr = 0;
+
+	while (nr < max - 1 && from[nr] != '\0')
+		nr++;
+	copy_user(to, from, nr);
+	to[nr] = '\0';
+}
 static inline int match(char *str1, char *str2, int nr)
 {
-	for (int i = 0; i < nr; i++)
-	{
-		if (str1[i] != str2[i])
-			return 0;
-		if (str1[i] == '\0')
-			return 1;
-	}
-	return 0;
+	return match_fast(str1, str2, nr);
 }
\ No newline at end of file
@@ -7,12 +7,20 @@
 
 void main()
 {
+	mem_ops_init();
 	mem_init();
 	init_buddy();
 	con_init();
 	disk_init();
 	excp_init();
 	process_init();
+#ifdef BENCH
+	bench_buddy();
+	bench_mem();
+#endif
+	lock_kernel();
+	smp_init();
+	unlock_kernel();
 	int_on();
 	asm volatile(
 		"csrwr %0, %1\n"
@@ -0,0 +1,164 @@
+#include <xtos.h>
+
+#define IOCSR_IPI_STATUS 0x1000
+#define IOCSR_IPI_EN 0x1004
+#define IOCSR_IPI_CLEAR 0x100c
+#define IOCSR_IPI_SEND 0x1040
+#define IOCSR_MBUF_SEND 0x1048
+#define IPI_SEND_BLOCKING (1U << 31)
+#define IPI_SEND_CPU_SHIFT 16
+#define MBUF_SEND_BLOCKING (1UL << 31)
+#define MBUF_SEND_BOX_SHIFT 2
+#define MBUF_SEND_CPU_SHIFT 16
+#define MBUF_SEND_BUF_SHIFT 32
+#define MBUF_SEND_H32_MASK 0xffffffff00000000UL
+#define CSR_SAVE0 0x30
+#define BOOT_TIMEOUT 10
+
+struct cpu cpus[NR_CPU];
+int nr_cpu_online = 1;
+int kernel_lock = 0;
+int kernel_lock_owner = -1;
+unsigned long smp_boot_stack;
+extern struct kmem_cache *process_cache;
+
+void smp_entry();
+
+void send_ipi(int cpu, int action)
+{
+	write_iocsr_32(IPI_SEND_BLOCKING | (cpu << IPI_SEND_CPU_SHIFT) | action, IOCSR_IPI_SEND);
+}
+void send_mail(int cpu, int box, unsigned long data)
+{
+	write_iocsr(MBUF_SEND_BLOCKING | ((box * 2UL + 1) << MBUF_SEND_BOX_SHIFT) | ((unsigned long)cpu << MBUF_SEND_CPU_SHIFT) | (data & MBUF_SEND_H32_MASK), IOCSR_MBUF_SEND);
+	write_iocsr(MBUF_SEND_BLOCKING | ((box * 2UL) << MBUF_SEND_BOX_SHIFT) | ((unsigned long)cpu << MBUF_SEND_CPU_SHIFT) | (data << MBUF_SEND_BUF_SHIFT), IOCSR_MBUF_SEND);
+}
+void handle_ipi()
+{
+	unsigned int status;
+
+	status = read_iocsr_32(IOCSR_IPI_STATUS);
+	write_iocsr_32(status, IOCSR_IPI_CLEAR);
+	if (status & (1U << IPI_TLB))
+		do_tlb_shootdown();
+	if (status & (1U << IPI_RESCHED))
+		this_cpu()->need_resched = 1;
+}
+void tlb_shootdown(int cpu, unsigned long asid, unsigned long u_vaddr)
+{
+	struct cpu *target;
+
+	target = &cpus[cpu];
+	target->flush_asid = asid;
+	target->flush_va = u_vaddr;
+	__atomic_store_n(&target->flush_pending, 1, __ATOMIC_RELEASE);
+	send_ipi(cpu, IPI_TLB);
+	while (target->flush_pending)
+		;
+}
+void do_tlb_shootdown()
+{
+	struct cpu *cpu;
+
+	cpu = this_cpu();
+	if (!cpu->flush_pending)
+		return;
+	if (cpu->flush_va == -1UL)
+		invalidate_asid(cpu->flush_asid);
+	else
+		invalidate_page(cpu->flush_asid, cpu->flush_va);
+	__atomic_store_n(&cpu->flush_pending, 0, __ATOMIC_RELEASE);
+}
+void lock_kernel()
+{
+	struct cpu *cpu;
+
+	cpu = this_cpu();
+	if (kernel_lock_owner == cpu->id)
+	{
+		cpu->curr->lock_depth++;
+		return;
+	}
+	while (__atomic_exchange_n(&kernel_lock, 1, __ATOMIC_ACQUIRE))
+		while (*(volatile int *)&kernel_lock)
+			do_tlb_shootdown();
+	kernel_lock_owner = cpu->id;
+	cpu->curr->lock_depth = 1;
+}
+void unlock_kernel()
+{
+	if (--current->lock_depth)
+		return;
+	kernel_lock_owner = -1;
+	spin_unlock(&kernel_lock);
+}
+void enter_kernel()
+{
+	do_tlb_shootdown();
+	lock_kernel();
+	account_user();
+}
+void leave_kernel()
+{
+	account_system();
+	unlock_kernel();
+}
+void idle_cpu()
+{
+	int depth;
+
+	depth = current->lock_depth;
+	current->lock_depth = 1;
+	unlock_kernel();
+	cpu_idle();
+	lock_kernel();
+	current->lock_depth = depth;
+}
+void start_secondary()
+{
+	struct cpu *cpu;
+
+	cpu = this_cpu();
+	mmu_init();
+	excp_init_cpu();
+	write_iocsr_32(~0U, IOCSR_IPI_EN);
+	switch_mm(cpu->idle);
+	write_csr_64(cpu->idle->kstack + PAGE_SIZE, CSR_SAVE0);
+	*(volatile int *)&cpu->online = 1;
+	lock_kernel();
+	idle_loop();
+}
+void smp_init()
+{
+	struct process *idle;
+	unsigned long deadline;
+	int i;
+
+	write_iocsr_32(~0U, IOCSR_IPI_EN);
+	for (i = 1; i < NR_CPU; i++)
+	{
+		idle = (struct process *)kmem_cache_alloc(process_cache);
+		set_mem((char *)idle, 0, sizeof(struct process));
+		idle->kstack = get_page(1, GFP_NOZERO);
+		idle->page_directory = cpus[0].idle->page_directory;
+		idle->state = TASK_RUNNING;
+		idle->cpu = i;
+		cpus[i].idle = idle;
+		cpus[i].curr = idle;
+		smp_boot_stack = idle->kstack + PAGE_SIZE;
+		send_mail(i, 0, (unsigned long)smp_entry & ~DMW_MASK);
+		send_ipi(i, IPI_BOOT);
+		deadline = get_cycles() + BOOT_TIMEOUT * cycles_per_tick;
+		while (!*(volatile int *)&cpus[i].online && get_cycles() < deadline)
+			;
+		if (!cpus[i].online)
+		{
+			free_page(idle->kstack);
+			kmem_cache_free(process_cache, idle);
+			cpus[i].idle = 0;
+			cpus[i].curr = 0;
+			break;
+		}
+		nr_cpu_online++;
+	}
+}
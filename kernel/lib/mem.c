@@ -0,0 +1,195 @@
+#include <xtos.h>
+
+#define CPUCFG1 1
+#define CPUCFG2 2
+#define CPUCFG1_UAL (1U << 20)
+#define CPUCFG2_FP (1U << 0)
+#define CPUCFG2_LSX (1U << 6)
+#define CPUCFG2_LASX (1U << 7)
+#define SIMD_MIN 256
+#define ONES 0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+void set_mem_lsx(char *, int, int);
+void copy_mem_lsx(char *, char *, int);
+void set_mem_lasx(char *, int, int);
+void copy_mem_lasx(char *, char *, int);
+
+void set_mem_word(char *, int, int);
+void copy_mem_word(char *, char *, int);
+int match_word(char *, char *, int);
+
+void (*set_mem_fast)(char *, int, int) = set_mem_word;
+void (*copy_mem_fast)(char *, char *, int) = copy_mem_word;
+int (*match_fast)(char *, char *, int) = match_word;
+int mem_ual;
+unsigned int simd_euen;
+
+void set_mem_word(char *to, int c, int nr)
+{
+	unsigned long val;
+
+	val = (unsigned char)c * ONES;
+	for (; nr > 0 && ((unsigned long)to & 7); nr--)
+		*to++ = c;
+	for (; nr >= 8; nr -= 8, to += 8)
+		*(unsigned long *)to = val;
+	for (; nr > 0; nr--)
+		*to++ = c;
+}
+void copy_mem_word(char *to, char *from, int nr)
+{
+	for (; nr > 0 && ((unsigned long)to & 7); nr--)
+		*to++ = *from++;
+	if (mem_ual || !((unsigned long)from & 7))
+	{
+		for (; nr >= 8; nr -= 8, to += 8, from += 8)
+			*(unsigned long *)to = *(unsigned long *)from;
+	}
+	for (; nr > 0; nr--)
+		*to++ = *from++;
+}
+int match_word(char *str1, char *str2, int nr)
+{
+	unsigned long a, b;
+	int i = 0;
+
+	if (mem_ual || !(((unsigned long)str1 | (unsigned long)str2) & 7))
+	{
+		for (; i + 8 <= nr; i += 8)
+		{
+			// 名字可能在用户页末尾，按字读取不能越过NUL所在的页
+			if (PAGE_SIZE - ((unsigned long)(str1 + i) & (PAGE_SIZE - 1)) < 8 ||
+				PAGE_SIZE - ((unsigned long)(str2 + i) & (PAGE_SIZE - 1)) < 8)
+				break;
+			a = *(unsigned long *)(str1 + i);
+			b = *(unsigned long *)(str2 + i);
+			if (a != b || ((a - ONES) & ~a & HIGHS))
+				break;
+		}
+	}
+	for (; i < nr; i++)
+	{
+		if (str1[i] != str2[i])
+			return 0;
+		if (str1[i] == '\0')
+			return 1;
+	}
+	return 0;
+}
+unsigned int simd_begin()
+{
+	unsigned int euen;
+
+	release_fpu();
+	euen = read_csr_32(CSR_EUEN);
+	write_csr_32(euen | simd_euen, CSR_EUEN);
+	return euen;
+}
+void simd_end(unsigned int euen)
+{
+	write_csr_32(euen, CSR_EUEN);
+}
+void set_mem_simd(char *to, int c, int nr)
+{
+	unsigned int euen;
+
+	if (nr < SIMD_MIN)
+	{
+		set_mem_word(to, c, nr);
+		return;
+	}
+	euen = simd_begin();
+	if (simd_euen & CSR_EUEN_ASXE)
+		set_mem_lasx(to, c, nr);
+	else
+		set_mem_lsx(to, c, nr);
+	simd_end(euen);
+}
+void copy_mem_simd(char *to, char *from, int nr)
+{
+	unsigned int euen;
+
+	if (nr < SIMD_MIN || (!mem_ual && (((unsigned long)to ^ (unsigned long)from) & 15)))
+	{
+		copy_mem_word(to, from, nr);
+		return;
+	}
+	euen = simd_begin();
+	if (simd_euen & CSR_EUEN_ASXE && (mem_ual || !(((unsigned long)to ^ (unsigned long)from) & 31)))
+		copy_mem_lasx(to, from, nr);
+	else
+		copy_mem_lsx(to, from, nr);
+	simd_end(euen);
+}
+void mem_ops_init()
+{
+	unsigned int cfg1, cfg2;
+
+	cfg1 = read_cpucfg(CPUCFG1);
+	cfg2 = read_cpucfg(CPUCFG2);
+	mem_ual = (cfg1 & CPUCFG1_UAL) != 0;
+	if (!(cfg2 & CPUCFG2_FP) || !(cfg2 & CPUCFG2_LSX))
+		return;
+	simd_euen = CSR_EUEN_FPE | CSR_EUEN_SXE;
+	if (cfg2 & CPUCFG2_LASX)
+		simd_euen |= CSR_EUEN_ASXE;
+	set_mem_fast = set_mem_simd;
+	copy_mem_fast = copy_mem_simd;
+}
+#ifdef BENCH
+#define BENCH_MEM_BYTES (4 << 20)
+
+static void set_mem_byte(char *to, int c, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		to[i] = c;
+}
+static void copy_mem_byte(char *to, char *from, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		to[i] = from[i];
+}
+static void bench_mem_op(char *name, void (*set)(char *, int, int), void (*copy)(char *, char *, int), char *to, char *from)
+{
+	static int sizes[] = {512, PAGE_SIZE, BENCH_MEM_BYTES};
+	unsigned long start, cycles;
+	int i, j;
+
+	printk(name);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		start = get_cycles();
+		for (j = 0; j < BENCH_MEM_BYTES / sizes[i]; j++)
+		{
+			if (set)
+				set(to, 0, sizes[i]);
+			else
+				copy(to, from, sizes[i]);
+		}
+		cycles = get_cycles() - start;
+		print_debug("size: ", sizes[i]);
+		print_debug("bytes per 100 cycles: ", BENCH_MEM_BYTES * 100UL / (cycles ? cycles : 1));
+	}
+}
+void bench_mem()
+{
+	char *to, *from;
+
+	to = (char *)get_page(BENCH_MEM_BYTES / PAGE_SIZE, GFP_NOZERO);
+	from = (char *)get_page(BENCH_MEM_BYTES / PAGE_SIZE, 0);
+	print_debug("simd euen: ", simd_euen);
+	bench_mem_op("set_mem byte\n", set_mem_byte, 0, to, from);
+	bench_mem_op("set_mem word\n", set_mem_word, 0, to, from);
+	bench_mem_op("set_mem fast\n", set_mem_fast, 0, to, from);
+	bench_mem_op("copy_mem byte\n", 0, copy_mem_byte, to, from);
+	bench_mem_op("copy_mem word\n", 0, copy_mem_word, to, from);
+	bench_mem_op("copy_mem fast\n", 0, copy_mem_fast, to, from);
+	free_page((unsigned long)to);
+	free_page((unsigned long)from);
+}
+#endif
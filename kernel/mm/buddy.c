@@ -1,79 +1,91 @@
-#define MAX_ORDER 15
-#define MAX_PAGE_NUM  32768 // 如果太大可以减小，定义物理页面的最大数量
+#include <xtos.h>
 
-// 伙伴id，互为伙伴的块从中取出一个id，并标记为使用
-static int buddy_id[32768]; 
+#define MAX_ORDER 15
 
-/* 
+/*
 后面的所有物理页地址都指的是mem_map数组中的索引，
-这些索引是用来标识物理页在内存中的位置。
+这些索引是用来标识物理页在内存中的位置，即物理页号。
+mem_map由mem_init()根据实际内存大小在内核映像之后分配，
+每个物理页只占一个很小的描述符：
+- order：若该页是块的首页，记录块的阶数
+- flags：PAGE_RESERVED表示该页不归伙伴系统管理（固件、内核映像、mem_map本身、内存空洞），
+  PAGE_BUDDY表示空闲块的首页，PAGE_HEAD表示已分配块的首页
 */
 
-// 空闲表节点，表示每个空闲块的信息
-typedef struct buddy_free_node
+// 空闲链表节点，直接存放在空闲块首页的内存中，不占用额外的元数据
+typedef struct free_block
 {
-    int page_index_start; // 空闲块起始页的索引
-    int buddy_id;         // 该块对应的伙伴的ID
-} buddy_free_node;
+    struct free_block *next;
+    struct free_block *prev;
+} free_block;
 
-// 空闲表结构，表示所有的空闲块，按阶数分组
-typedef struct buddy_free_table
-{
-    /* 
-    空闲表由多个链表组成，按阶数（block size的对数）分组。
-    第一维表示阶数。
-    第二维表示该阶数下的空闲块链表。
-    由于无法使用malloc，我们静态分配全部空间并将其当作一个栈使用：
-    - 新增空闲块时，入栈；
-    - 分配时，出栈。
-    */
-    buddy_free_node table[MAX_ORDER + 1][MAX_PAGE_NUM];
-    // 每个阶数对应的栈顶指针
-    int stack_top[MAX_ORDER + 1];
-} buddy_free_table;
-
-// 分配表节点，记录已分配块的信息
-typedef struct buddy_occu_node
-{
-    int page_index_start; // 已分配块的起始页索引
-    int buddy_id;         // 该块的伙伴ID
-} buddy_occu_node;
+// 每个阶数一条带头结点的双向循环空闲链表
+static free_block free_area[MAX_ORDER + 1];
 
-// 分配表结构，记录已分配的块信息
-typedef struct buddy_occu_table
-{
-    // 记录每个阶数下已分配的块信息，类似空闲表的结构
-    buddy_occu_node table[MAX_ORDER][MAX_PAGE_NUM];
-    // 每个阶数对应的栈顶指针
-    int stack_top[MAX_ORDER + 1];
-} buddy_occu_table;
+// 所有空闲链表中的页数
+unsigned long nr_buddy_free;
+
+static free_block *page_to_block(unsigned long page) {
+    return (free_block *)((page << 12) | DMW_MASK);
+}
+
+static unsigned long block_to_page(free_block *block) {
+    return ((unsigned long)block & ~DMW_MASK) >> 12;
+}
+
+// 将块首页page加入order阶空闲链表的表头
+static void free_list_add(unsigned long page, int order) {
+    free_block *block = page_to_block(page);
+
+    mem_map[page].order = order;
+    mem_map[page].flags |= PAGE_BUDDY;
+    nr_buddy_free += 1UL << order;
+    block->prev = &free_area[order];
+    block->next = free_area[order].next;
+    free_area[order].next->prev = block;
+    free_area[order].next = block;
+}
+
+// 将块首页page从其所在阶的空闲链表中摘除
+static void free_list_del(unsigned long page) {
+    free_block *block = page_to_block(page);
 
-// 空闲表和分配表的实例
-static buddy_free_table free_table;
-static buddy_occu_table occu_table;
+    block->prev->next = block->next;
+    block->next->prev = block->prev;
+    mem_map[page].flags &= ~PAGE_BUDDY;
+    nr_buddy_free -= 1UL << mem_map[page].order;
+}
 
 // 初始化伙伴系统
-// 初始化空闲表、分配表和伙伴ID数组
+// 按mem_map中的保留标记，把所有可用的连续页段切成尽量大的对齐块放入空闲链表
 void init_buddy() {
-    // 初始化伙伴ID数组，每个物理页分配一个唯一ID，ID值从0开始
-    for (int i = 0; i < MAX_PAGE_NUM; i++) {
-        buddy_id[i] = i;
-    }
-    
-    // 初始化空闲表，设置每个阶数的栈顶为-1，表示栈为空
+    unsigned long start, end;
+    int order;
+
     for (int i = 0; i <= MAX_ORDER; i++) {
-        free_table.stack_top[i] = -1;  
+        free_area[i].next = &free_area[i];
+        free_area[i].prev = &free_area[i];
     }
-    
-    // 初始化分配表，设置每个阶数的栈顶为-1，表示栈为空
-    for (int i = 0; i <= MAX_ORDER; i++) {
-        occu_table.stack_top[i] = -1;
+
+    // 从高地址向低地址处理，使低地址的块最后入链、最先被分配
+    end = nr_page;
+    while (end > 0) {
+        // 跳过保留页，找到一段连续可用页[start, end)
+        while (end > 0 && (mem_map[end - 1].flags & PAGE_RESERVED))
+            end--;
+        start = end;
+        while (start > 0 && !(mem_map[start - 1].flags & PAGE_RESERVED))
+            start--;
+
+        // 从段尾开始切块：块必须按自身大小对齐且不能越过段首
+        while (end > start) {
+            order = 0;
+            while (order < MAX_ORDER && (end & ((2UL << order) - 1)) == 0 && end - (2UL << order) >= start)
+                order++;
+            end -= 1UL << order;
+            free_list_add(end, order);
+        }
     }
-    
-    // 初始时，将整个内存作为一个大块放入最高阶的空闲表中
-    free_table.stack_top[MAX_ORDER] = 0;
-    free_table.table[MAX_ORDER][0].page_index_start = 0;
-    free_table.table[MAX_ORDER][0].buddy_id = buddy_id[0];
 }
 
 // 计算所需的阶数（根据请求的大小）
@@ -92,109 +104,93 @@ int get_page_buddy(int size) {
     if (size <= 0 || size > (1 << MAX_ORDER)) {
         return -1;  // 请求的大小无效
     }
-    
+
     // 根据请求的大小计算需要的阶数
     int order = calculate_order(size);
     int current_order = order;
-    
+
     // 查找合适的空闲块
-    while (current_order <= MAX_ORDER) {
-        if (free_table.stack_top[current_order] >= 0) {
-            // 找到可用的空闲块
-            int stack_index = free_table.stack_top[current_order];
-            int page_start = free_table.table[current_order][stack_index].page_index_start;
-            int current_buddy_id = free_table.table[current_order][stack_index].buddy_id;
-            
-            // 从空闲表移除该块（栈操作）
-            free_table.stack_top[current_order]--;
-            
-            // 将块添加到分配表中
-            occu_table.stack_top[order]++;
-            occu_table.table[order][occu_table.stack_top[order]].page_index_start = page_start;
-            occu_table.table[order][occu_table.stack_top[order]].buddy_id = current_buddy_id;
-            
-            // 如果块太大，需要进行分割
-            while (current_order > order) {
-                current_order--;
-                int buddy_page = page_start + (1 << current_order);
-                
-                // 将分割出的伙伴块加入空闲表
-                free_table.stack_top[current_order]++;
-                free_table.table[current_order][free_table.stack_top[current_order]].page_index_start = buddy_page;
-                free_table.table[current_order][free_table.stack_top[current_order]].buddy_id = buddy_id[buddy_page];
-            }
-            
-            return page_start;
-        }
+    while (current_order <= MAX_ORDER && free_area[current_order].next == &free_area[current_order])
         current_order++;
+    if (current_order > MAX_ORDER)
+        return -1;  // 无法找到合适的空闲块
+
+    // 从空闲链表中取出该块
+    unsigned long page_start = block_to_page(free_area[current_order].next);
+    free_list_del(page_start);
+
+    // 如果块太大，需要进行分割，分割出的后一半作为伙伴块加入空闲链表
+    while (current_order > order) {
+        current_order--;
+        free_list_add(page_start + (1UL << current_order), current_order);
     }
 
-    return -1;  // 无法找到合适的空闲块
+    // 在首页描述符中记录该块已分配及其阶数
+    mem_map[page_start].order = order;
+    mem_map[page_start].flags |= PAGE_HEAD;
+    return page_start;
 }
 
 // 释放已分配的物理页
 // page为释放的物理页的起始地址（即在mem_map数组中的索引）
-void free_buddy_page(int page) {
-    // 查找要释放的页面在分配表中的位置
-    int found_order = -1;
-    int found_index = -1;
-    
-    for (int order = 0; order <= MAX_ORDER; order++) {
-        for (int i = 0; i <= occu_table.stack_top[order]; i++) {
-            if (occu_table.table[order][i].page_index_start == page) {
-                found_order = order;
-                found_index = i;
-                break;
-            }
-        }
-        if (found_order != -1) break;  // 找到目标页面
-    }
-    
-    if (found_order == -1) return;  // 页面未被分配，释放失败
-    
-    // 从分配表中移除该块（栈操作）
-    int current_buddy_id = occu_table.table[found_order][found_index].buddy_id;
-    for (int i = found_index; i < occu_table.stack_top[found_order]; i++) {
-        // 手动复制数组元素
-        occu_table.table[found_order][i].page_index_start = occu_table.table[found_order][i + 1].page_index_start;
-        occu_table.table[found_order][i].buddy_id = occu_table.table[found_order][i + 1].buddy_id;
-    }
-    occu_table.stack_top[found_order]--;
-    
+// 成功返回0，page不是已分配块的首页则返回-1
+int free_buddy_page(int page) {
+    if (page < 0 || page >= nr_page || !(mem_map[page].flags & PAGE_HEAD))
+        return -1;  // 页面未被分配，释放失败
+
     // 释放后尝试能否合并相邻伙伴块
-    int current_order = found_order;
-    int current_page = page;
-    
+    int current_order = mem_map[page].order;
+    unsigned long current_page = page;
+    mem_map[page].flags &= ~PAGE_HEAD;
+
     while (current_order < MAX_ORDER) {
-        int buddy_page = current_page ^ (1 << current_order);  // 计算伙伴块的地址
-        int found_buddy = 0;
-        
-        // 在空闲表中查找伙伴块
-        for (int i = 0; i <= free_table.stack_top[current_order]; i++) {
-            if (free_table.table[current_order][i].page_index_start == buddy_page) {
-                // 找到伙伴块，可以合并
-                found_buddy = 1;
-                
-                // 从空闲表中移除伙伴块（栈操作）
-                for (int j = i; j < free_table.stack_top[current_order]; j++) {
-                    // 手动复制数组元素
-                    free_table.table[current_order][j].page_index_start = free_table.table[current_order][j + 1].page_index_start;
-                    free_table.table[current_order][j].buddy_id = free_table.table[current_order][j + 1].buddy_id;
-                }
-                free_table.stack_top[current_order]--;
-                
-                // 准备下一次合并
-                current_page = (current_page < buddy_page) ? current_page : buddy_page;
-                current_order++;
-                break;
-            }
-        }
-        
-        if (!found_buddy) break;  // 没有找到伙伴，停止合并
+        unsigned long buddy_page = current_page ^ (1UL << current_order);  // 计算伙伴块的地址
+
+        // 伙伴块必须是同阶的空闲块才能合并，保留页永远不会被标记为空闲
+        if (buddy_page >= nr_page || !(mem_map[buddy_page].flags & PAGE_BUDDY) || mem_map[buddy_page].order != current_order)
+            break;
+
+        // 从空闲链表中摘除伙伴块，准备下一次合并
+        free_list_del(buddy_page);
+        current_page = (current_page < buddy_page) ? current_page : buddy_page;
+        current_order++;
+    }
+
+    // 将合并后的块加入空闲链表
+    free_list_add(current_page, current_order);
+    return 0;
+}
+
+// 把一个已分配的块拆成若干个各自独立的0阶已分配页
+// 用于一次从伙伴系统批量取出多个单页，之后每一页都可以单独释放并参与合并
+void split_buddy_page(int page) {
+    int nr = 1 << mem_map[page].order;
+
+    for (int i = 0; i < nr; i++) {
+        mem_map[page + i].order = 0;
+        mem_map[page + i].flags |= PAGE_HEAD;
+    }
+}
+
+#ifdef BENCH
+#define BENCH_BUDDY_PAGES 1024
+
+// 启动时的伙伴系统基准测试（make BENCH=1时编译）
+// 对0、2、4阶分别连续分配BENCH_BUDDY_PAGES个块再全部释放，
+// 已分配块越多，旧的occu_table扫描越慢，报告每对分配/释放的平均周期数
+void bench_buddy() {
+    static int pages[BENCH_BUDDY_PAGES];
+    unsigned long start;
+    int order, i;
+
+    for (order = 0; order <= 4; order += 2) {
+        start = get_cycles();
+        for (i = 0; i < BENCH_BUDDY_PAGES; i++)
+            pages[i] = get_page_buddy(1 << order);
+        for (i = 0; i < BENCH_BUDDY_PAGES; i++)
+            free_buddy_page(pages[i]);
+        print_debug("buddy order: ", order);
+        print_debug("cycles per alloc+free: ", (get_cycles() - start) / BENCH_BUDDY_PAGES);
     }
-    
-    // 将合并后的块加入空闲表
-    free_table.stack_top[current_order]++;
-    free_table.table[current_order][free_table.stack_top[current_order]].page_index_start = current_page;
-    free_table.table[current_order][free_table.stack_top[current_order]].buddy_id = current_buddy_id;
 }
+#endif
@@ -0,0 +1,78 @@
+#include <xtos.h>
+
+#define MAGAZINE_LOW 16
+#define MAGAZINE_HIGH 64
+#define MAGAZINE_BATCH 16
+
+struct magazine magazine = {0, MAGAZINE_LOW, MAGAZINE_HIGH, MAGAZINE_BATCH, 0, 0};
+int magazine_pages[MAGAZINE_HIGH + 1];
+
+void refill_magazine()
+{
+	int page;
+	int i;
+
+	page = get_page_buddy(magazine.batch);
+	if (page != -1)
+	{
+		split_buddy_page(page);
+		for (i = 0; i < magazine.batch; i++)
+		{
+			mem_map[page + i].flags |= PAGE_CACHED;
+			magazine_pages[magazine.count++] = page + i;
+		}
+		return;
+	}
+	for (i = 0; i < magazine.batch; i++)
+	{
+		page = get_page_buddy(1);
+		if (page == -1)
+			break;
+		mem_map[page].flags |= PAGE_CACHED;
+		magazine_pages[magazine.count++] = page;
+	}
+}
+void drain_magazine()
+{
+	int nr, i;
+
+	nr = magazine.count - magazine.low;
+	for (i = 0; i < nr; i++)
+	{
+		mem_map[magazine_pages[i]].flags &= ~PAGE_CACHED;
+		free_buddy_page(magazine_pages[i]);
+	}
+	for (i = 0; i < magazine.low; i++)
+		magazine_pages[i] = magazine_pages[i + nr];
+	magazine.count = magazine.low;
+}
+int get_page_magazine()
+{
+	int page;
+
+	if (magazine.count)
+		magazine.hit++;
+	else
+	{
+		magazine.miss++;
+		refill_magazine();
+		if (!magazine.count)
+			return -1;
+	}
+	page = magazine_pages[--magazine.count];
+	mem_map[page].flags &= ~PAGE_CACHED;
+	return page;
+}
+void free_page_magazine(int page)
+{
+	mem_map[page].flags |= PAGE_CACHED;
+	magazine_pages[magazine.count++] = page;
+	if (magazine.count > magazine.high)
+		drain_magazine();
+}
+void magazine_stats()
+{
+	print_debug("magazine pages: ", magazine.count);
+	print_debug("magazine hits: ", magazine.hit);
+	print_debug("magazine misses: ", magazine.miss);
+}
@@ -1,22 +1,49 @@
 #include <xtos.h>
 
+#define CSR_ASID 0x18
+#define CSR_PGDL 0x19
 #define CSR_PWCL 0x1c
+#define CSR_PWCH 0x1d
 #define CSR_DMW0 0x180
 #define CSR_DMW3 0x183
 #define CSR_DMW0_PLV0 (1UL << 0)
-#define MEMORY_SIZE 0x8000000
-#define NR_PAGE (MEMORY_SIZE >> 12)
-#define KERNEL_START_PAGE (0x200000UL >> 12)
-#define KERNEL_END_PAGE (0x300000UL >> 12)
+#ifndef MEMORY_SIZE
+#define MEMORY_SIZE 0x80000000UL
+#endif
+#define LOWMEM_BASE 0x0UL
+#define LOWMEM_SIZE 0x10000000UL
+#define HIGHMEM_BASE 0x90000000UL
 #define ENTRY_SIZE 8
 #define PWCL_PTBASE 12
 #define PWCL_PTWIDTH 9
 #define PWCL_PDBASE 21
 #define PWCL_PDWIDTH 9
+#define PWCL_DIR2BASE 30
+#define PWCL_DIR2WIDTH (PT_LEVELS > 2 ? 9 : 0)
 #define PWCL_EWIDTH 0
+#define PWCH_DIR3BASE 39
+#define PWCH_DIR3WIDTH (PT_LEVELS > 3 ? 9 : 0)
 #define ENTRYS 512
+#define CSR_ASID_BITS (0xffUL << 16)
+#define CPUCFG1 1
+#define CPUCFG1_VALEN (0xffU << 12)
+#define NR_ZERO_PAGE 64
 
-char mem_map[NR_PAGE];
+struct mem_region
+{
+	unsigned long base, size;
+};
+
+extern char _end[];
+struct mem_region mem_regions[] = {
+	{LOWMEM_BASE, MEMORY_SIZE < LOWMEM_SIZE ? MEMORY_SIZE : LOWMEM_SIZE},
+	{HIGHMEM_BASE, MEMORY_SIZE < LOWMEM_SIZE ? 0 : MEMORY_SIZE - LOWMEM_SIZE}};
+struct page *mem_map;
+unsigned long nr_page;
+unsigned long zero_pages[NR_ZERO_PAGE];
+int nr_zero_page;
+unsigned long asid_mask;
+int page_lock = 0;
 
 // unsigned long get_page()
 // {
@@ -36,26 +63,83 @@ char mem_map[NR_PAGE];
 // 	return 0;
 // }
 
-unsigned long get_page(int size)
+unsigned long get_page(int size, int flags)
 {
 	unsigned long page;
 	unsigned long i;
+	int j;
 
-	i = get_page_buddy(size);
-    if(i == -1)
-    {
-        panic("panic: out of memory!\n");
-        return 0;
-    }
-    
-	page = (i << 12) | DMW_MASK;
-    for(int j = 0; j < size; j++)
-    {
-        unsigned long tmp_page = page + 4096 * j;
-        set_mem((char *)tmp_page, 0, PAGE_SIZE);
-    }
-	
-    return page;
+	spin_lock(&page_lock);
+	if (size == 1 && !(flags & GFP_NOZERO) && nr_zero_page)
+		page = zero_pages[--nr_zero_page];
+	else
+	{
+		if (size == 1)
+			i = get_page_magazine();
+		else
+			i = get_page_buddy(size);
+		if (i == -1)
+		{
+			if (flags & GFP_TRY)
+			{
+				spin_unlock(&page_lock);
+				return 0;
+			}
+			if (size != 1 || !nr_zero_page)
+			{
+				spin_unlock(&page_lock);
+				if (reclaim_pages())
+					return get_page(size, flags);
+				panic("panic: out of memory!\n");
+				return 0;
+			}
+			page = zero_pages[--nr_zero_page];
+		}
+		else
+		{
+			mem_map[i].count = 1;
+			spin_unlock(&page_lock);
+			page = (i << 12) | DMW_MASK;
+			if (!(flags & GFP_NOZERO))
+			{
+				for (j = 0; j < size; j++)
+					set_mem((char *)(page + PAGE_SIZE * j), 0, PAGE_SIZE);
+			}
+			return page;
+		}
+	}
+	mem_map[(page & ~DMW_MASK) >> 12].count = 1;
+	spin_unlock(&page_lock);
+	return page;
+}
+void share_page(unsigned long page)
+{
+	spin_lock(&page_lock);
+	mem_map[(page & ~DMW_MASK) >> 12].count++;
+	spin_unlock(&page_lock);
+}
+unsigned long nr_free_pages()
+{
+	return nr_buddy_free + magazine.count + nr_zero_page;
+}
+int zero_page_idle()
+{
+	unsigned long page;
+	int i;
+
+	if (nr_zero_page == NR_ZERO_PAGE)
+		return 0;
+	spin_lock(&page_lock);
+	i = get_page_magazine();
+	spin_unlock(&page_lock);
+	if (i == -1)
+		return 0;
+	page = ((unsigned long)i << 12) | DMW_MASK;
+	set_mem((char *)page, 0, PAGE_SIZE);
+	spin_lock(&page_lock);
+	zero_pages[nr_zero_page++] = page;
+	spin_unlock(&page_lock);
+	return 1;
 }
 
 // void free_page(unsigned long page)
@@ -73,26 +157,82 @@ void free_page(unsigned long page)
 	unsigned long i;
 
 	i = (page & ~DMW_MASK) >> 12;
-
-    int success = 1;
-	free_buddy_page(i);
-	if (!success)
+	if (i >= nr_page || (mem_map[i].flags & (PAGE_HEAD | PAGE_CACHED)) != PAGE_HEAD)
 		panic("panic: try to free free page!\n");
+	spin_lock(&page_lock);
+	if (--mem_map[i].count == 0)
+	{
+		if (mem_map[i].order == 0)
+			free_page_magazine(i);
+		else if (free_buddy_page(i) == -1)
+			panic("panic: try to free free page!\n");
+	}
+	spin_unlock(&page_lock);
 }
 
+void set_entry(unsigned long *entry, unsigned long val)
+{
+	struct page *table;
+
+	table = &mem_map[((unsigned long)entry & ~DMW_MASK) >> 12];
+	if (!*entry && val)
+		table->used++;
+	else if (*entry && !val)
+		table->used--;
+	*entry = val;
+}
+unsigned long *walk_page_table(struct process *p, unsigned long u_vaddr, int level, int create)
+{
+	unsigned long table;
+	unsigned long *entry;
+	int l;
+
+	table = p->page_directory;
+	for (l = PT_LEVELS - 1;; l--)
+	{
+		entry = (unsigned long *)(table + ((u_vaddr >> (12 + 9 * l)) & 0x1ff) * ENTRY_SIZE);
+		if (l == level)
+			return entry;
+		if (!*entry)
+		{
+			if (!create)
+				return 0;
+			table = get_page(1, 0);
+			set_entry(entry, table & ~DMW_MASK);
+		}
+		else
+			table = *entry | DMW_MASK;
+	}
+}
+unsigned long *find_pde(struct process *p, unsigned long u_vaddr)
+{
+	return walk_page_table(p, u_vaddr, 1, 0);
+}
+unsigned long *find_pte(struct process *p, unsigned long u_vaddr)
+{
+	unsigned long *pde;
+
+	pde = find_pde(p, u_vaddr);
+	if (!pde || !*pde)
+		return 0;
+	if (*pde & PTE_HUGE)
+		return pde;
+	return (unsigned long *)((*pde | DMW_MASK) + ((u_vaddr >> 12) & 0x1ff) * ENTRY_SIZE);
+}
 unsigned long *get_pte(struct process *p, unsigned long u_vaddr)
 {
-	unsigned long pd, pt;
+	unsigned long pt;
 	unsigned long *pde, *pte;
 
-	pd = p->page_directory;
-	pde = (unsigned long *)(pd + ((u_vaddr >> 21) & 0x1ff) * ENTRY_SIZE);
+	pde = walk_page_table(p, u_vaddr, 1, 1);
+	if (*pde & PTE_HUGE)
+		panic("panic: try to remap huge page!\n");
 	if (*pde)
 		pt = *pde | DMW_MASK;
 	else
 	{
-		pt = get_page(1);
-		*pde = pt & ~DMW_MASK;
+		pt = get_page(1, 0);
+		set_entry(pde, pt & ~DMW_MASK);
 	}
 	pte = (unsigned long *)(pt + ((u_vaddr >> 12) & 0x1ff) * ENTRY_SIZE);
 	return pte;
@@ -104,79 +244,349 @@ void put_page(struct process *p, unsigned long u_vaddr, unsigned long k_vaddr, u
 	pte = get_pte(p, u_vaddr);
 	if (*pte)
 		panic("panic: try to remap!\n");
-	*pte = (k_vaddr & ~DMW_MASK) | attr;
-	invalidate();
+	set_entry(pte, (k_vaddr & ~DMW_MASK) | attr);
+	flush_tlb_page(p, u_vaddr);
 }
-void free_page_table(struct process *p)
+void put_huge_page(struct process *p, unsigned long u_vaddr, unsigned long k_vaddr, unsigned long attr)
+{
+	unsigned long *pde;
+
+	pde = walk_page_table(p, u_vaddr, 1, 1);
+	if (*pde)
+		panic("panic: try to remap!\n");
+	set_entry(pde, (k_vaddr & ~DMW_MASK) | attr | PTE_HUGE);
+	flush_tlb_page(p, u_vaddr);
+}
+void unmap_page(struct process *p, unsigned long u_vaddr)
+{
+	unsigned long *entry[PT_LEVELS];
+	unsigned long table;
+	int l, leaf;
+
+	table = p->page_directory;
+	for (l = PT_LEVELS - 1; l >= 0; l--)
+	{
+		entry[l] = (unsigned long *)(table + ((u_vaddr >> (12 + 9 * l)) & 0x1ff) * ENTRY_SIZE);
+		if (!*entry[l])
+			return;
+		if (l == 0 || (l == 1 && (*entry[l] & PTE_HUGE)))
+			break;
+		table = *entry[l] | DMW_MASK;
+	}
+	leaf = l;
+	if (*entry[leaf] & PTE_SWAP)
+		free_swap_entry(*entry[leaf]);
+	else
+		free_page((~0xfffUL & *entry[leaf]) | DMW_MASK);
+	set_entry(entry[leaf], 0);
+	flush_tlb_page(p, u_vaddr);
+	for (l = leaf; l < PT_LEVELS - 1; l++)
+	{
+		table = (unsigned long)entry[l] & ~0xfffUL;
+		if (mem_map[(table & ~DMW_MASK) >> 12].used)
+			break;
+		free_page(table);
+		set_entry(entry[l + 1], 0);
+	}
+}
+void split_huge_page(struct process *p, unsigned long u_vaddr)
 {
-	unsigned long pd, pt;
 	unsigned long *pde, *pte;
-	unsigned long page;
+	unsigned long page, new_page, pt, attr;
+	int i;
 
-	pd = p->page_directory;
-	pde = (unsigned long *)pd;
-	for (int i = 0; i < ENTRYS; i++, pde++)
+	pde = find_pde(p, u_vaddr);
+	page = (~0xfffUL & *pde) | DMW_MASK;
+	attr = *pde & 0xfffUL & ~PTE_HUGE;
+	if (mem_map[(page & ~DMW_MASK) >> 12].count > 1)
+	{
+		new_page = get_page(HUGE_PAGE_NR, GFP_NOZERO);
+		copy_mem((char *)new_page, (char *)page, HUGE_PAGE_SIZE);
+		free_page(page);
+		page = new_page;
+	}
+	split_buddy_page((page & ~DMW_MASK) >> 12);
+	pt = get_page(1, 0);
+	pte = (unsigned long *)pt;
+	for (i = 0; i < HUGE_PAGE_NR; i++)
 	{
-		if (*pde == 0)
+		mem_map[((page & ~DMW_MASK) >> 12) + i].count = 1;
+		set_entry(pte + i, ((page + i * PAGE_SIZE) & ~DMW_MASK) | attr);
+	}
+	*pde = pt & ~DMW_MASK;
+	flush_tlb_page(p, u_vaddr & ~(HUGE_PAGE_SIZE - 1));
+}
+void unmap_range(struct process *p, unsigned long start, unsigned long end)
+{
+	unsigned long *pde;
+	unsigned long next;
+
+	while (start < end)
+	{
+		next = (start + HUGE_PAGE_SIZE) & ~(HUGE_PAGE_SIZE - 1);
+		pde = find_pde(p, start);
+		if (!pde || !*pde)
+		{
+			start = next;
 			continue;
-		pt = *pde | DMW_MASK;
-		pte = (unsigned long *)pt;
-		for (int j = 0; j < ENTRYS; j++, pte++)
+		}
+		if (*pde & PTE_HUGE)
 		{
-			if (*pte == 0)
+			if (start == next - HUGE_PAGE_SIZE && end >= next)
+			{
+				unmap_page(p, start);
+				start = next;
 				continue;
-			page = (~0xfffUL & *pte) | DMW_MASK;
-			free_page(page);
-			*pte = 0;
+			}
+			split_huge_page(p, start);
 		}
-		free_page(*pde | DMW_MASK);
-		*pde = 0;
+		for (; start < end && start < next; start += PAGE_SIZE)
+			unmap_page(p, start);
 	}
 }
-void copy_page_table(struct process *from, struct process *to)
+void free_table(unsigned long table, int level)
 {
-	unsigned long from_pd, to_pd, from_pt, to_pt;
-	unsigned long *from_pde, *to_pde, *from_pte, *to_pte;
-	unsigned long from_page, to_page;
-	int i, j;
+	unsigned long *entry;
+	int i;
 
-	from_pd = from->page_directory;
-	from_pde = (unsigned long *)from_pd;
-	to_pd = to->page_directory;
-	to_pde = (unsigned long *)to_pd;
-	for (i = 0; i < ENTRYS; i++, from_pde++, to_pde++)
+	entry = (unsigned long *)table;
+	for (i = 0; i < ENTRYS; i++, entry++)
 	{
-		if (*from_pde == 0)
+		if (*entry == 0)
 			continue;
-		from_pt = *from_pde | DMW_MASK;
-		from_pte = (unsigned long *)from_pt;
-		to_pt = get_page(1);
-		to_pte = (unsigned long *)to_pt;
-		*to_pde = to_pt & ~DMW_MASK;
-		for (j = 0; j < ENTRYS; j++, from_pte++, to_pte++)
+		if (level == 0 && (*entry & PTE_SWAP))
+			free_swap_entry(*entry);
+		else if (level == 0 || (*entry & PTE_HUGE))
+			free_page((~0xfffUL & *entry) | DMW_MASK);
+		else
 		{
-			if (*from_pte == 0)
-				continue;
-			from_page = (~0xfffUL & *from_pte) | DMW_MASK;
-			to_page = get_page(1);
-			*to_pte = (to_page & ~DMW_MASK) | (*from_pte & 0x1FF);
-			copy_mem((char *)to_page, (char *)from_page, PAGE_SIZE);
+			free_table(*entry | DMW_MASK, level - 1);
+			free_page(*entry | DMW_MASK);
 		}
+		*entry = 0;
 	}
+	mem_map[(table & ~DMW_MASK) >> 12].used = 0;
 }
-void mem_init()
+void free_page_table(struct process *p)
+{
+	free_table(p->page_directory, PT_LEVELS - 1);
+}
+void copy_table(unsigned long from, unsigned long to, int level)
 {
+	unsigned long *from_entry, *to_entry;
+	unsigned long table;
 	int i;
 
-	for (i = 0; i < NR_PAGE; i++)
+	from_entry = (unsigned long *)from;
+	to_entry = (unsigned long *)to;
+	for (i = 0; i < ENTRYS; i++, from_entry++, to_entry++)
 	{
-		if (i >= KERNEL_START_PAGE && i < KERNEL_END_PAGE)
-			mem_map[i] = 1;
+		if (*from_entry == 0)
+			continue;
+		if (level == 0 && (*from_entry & PTE_SWAP))
+		{
+			set_entry(to_entry, *from_entry);
+			dup_swap_entry(*from_entry);
+		}
+		else if (level == 0 || (*from_entry & PTE_HUGE))
+		{
+			if (!(*from_entry & PTE_SHARED))
+				*from_entry &= ~PTE_D;
+			set_entry(to_entry, *from_entry);
+			share_page((~0xfffUL & *from_entry) | DMW_MASK);
+		}
 		else
-			mem_map[i] = 0;
+		{
+			table = get_page(1, 0);
+			set_entry(to_entry, table & ~DMW_MASK);
+			copy_table(*from_entry | DMW_MASK, table, level - 1);
+		}
 	}
+}
+void copy_page_table(struct process *from, struct process *to)
+{
+	copy_table(from->page_directory, to->page_directory, PT_LEVELS - 1);
+	flush_tlb_mm(from);
+}
+void do_wp_page(unsigned long u_vaddr)
+{
+	unsigned long *pte;
+	unsigned long old_page, new_page;
+	int size;
+
+	pte = find_pte(current, u_vaddr);
+	if (!pte || !(*pte & PTE_V) || !(*pte & PTE_W))
+	{
+		bad_area(u_vaddr);
+		return;
+	}
+	old_page = (~0xfffUL & *pte) | DMW_MASK;
+	if (mem_map[(old_page & ~DMW_MASK) >> 12].count == 1)
+		*pte |= PTE_D;
+	else
+	{
+		size = (*pte & PTE_HUGE) ? HUGE_PAGE_NR : 1;
+		new_page = get_page(size, GFP_NOZERO);
+		copy_mem((char *)new_page, (char *)old_page, size * PAGE_SIZE);
+		*pte = (new_page & ~DMW_MASK) | (*pte & 0xfffUL) | PTE_D;
+		free_page(old_page);
+	}
+	flush_tlb_page(current, u_vaddr);
+}
+void bad_area(unsigned long u_vaddr)
+{
+	if (u_vaddr >= VMEM_SIZE || current->pid == 0)
+	{
+		print_debug("bad address: ", u_vaddr);
+		panic("panic: page fault!\n");
+	}
+	print_debug("segmentation fault: ", u_vaddr);
+	sys_exit(-1);
+}
+void fill_page(struct vm_area *vma, unsigned long u_vaddr, unsigned long page, int size)
+{
+	unsigned long offset;
+	int i;
+
+	offset = vma->offset + (u_vaddr - vma->start);
+	for (i = 0; i < size * (PAGE_SIZE / BLOCK_SIZE) && u_vaddr + i * BLOCK_SIZE < vma->end; i++)
+		read_inode_block(vma->inode, offset / BLOCK_SIZE + i, (char *)page + i * BLOCK_SIZE, BLOCK_SIZE);
+}
+void do_no_page(struct vm_area *vma, unsigned long u_vaddr)
+{
+	unsigned long page, base;
+	unsigned long *pde;
+	int flags = 0;
+
+	base = u_vaddr & ~(HUGE_PAGE_SIZE - 1);
+	pde = find_pde(current, base);
+	if ((vma->flags & VM_HUGE) && base >= vma->start && base + HUGE_PAGE_SIZE <= vma->end && (!pde || !*pde))
+	{
+		page = get_page(HUGE_PAGE_NR, GFP_TRY);
+		if (page)
+		{
+			put_huge_page(current, base, page, vma->attr);
+			return;
+		}
+	}
+	if (vma->inode)
+		flags = GFP_NOZERO;
+	if (vma->inode && vma->end - u_vaddr < PAGE_SIZE)
+		flags = 0;
+	page = get_page(1, flags);
+	if (vma->inode)
+		fill_page(vma, u_vaddr, page, 1);
+	put_page(current, u_vaddr, page, vma->attr);
+}
+void do_page_fault(unsigned long u_vaddr, int ecode)
+{
+	struct vm_area *vma;
+	unsigned long *pte;
+
+	if (ecode == EXCP_PME)
+	{
+		do_wp_page(u_vaddr);
+		return;
+	}
+	if (ecode == EXCP_PPI || u_vaddr >= VMEM_SIZE)
+	{
+		bad_area(u_vaddr);
+		return;
+	}
+	pte = find_pte(current, u_vaddr);
+	if (pte && (*pte & PTE_SWAP))
+	{
+		do_swap_page(pte, u_vaddr & ~(PAGE_SIZE - 1UL));
+		return;
+	}
+	if (pte && *pte)
+	{
+		*pte |= PTE_V;
+		flush_tlb_page(current, u_vaddr);
+		return;
+	}
+	vma = find_vma(current, u_vaddr);
+	if (!vma)
+	{
+		bad_area(u_vaddr);
+		return;
+	}
+	do_no_page(vma, u_vaddr & ~(PAGE_SIZE - 1UL));
+}
+void get_new_asid(struct cpu *cpu, struct process *p)
+{
+	if (!(++cpu->asid_next & asid_mask))
+		invalidate();
+	p->asid = cpu->asid_next;
+}
+void switch_mm(struct process *p)
+{
+	struct cpu *cpu;
+
+	cpu = this_cpu();
+	if ((p->asid ^ cpu->asid_next) & ~asid_mask)
+		get_new_asid(cpu, p);
+	write_csr_32(p->asid & asid_mask, CSR_ASID);
+	write_csr_64(p->page_directory & ~DMW_MASK, CSR_PGDL);
+}
+void flush_tlb_mm(struct process *p)
+{
+	if ((p->asid ^ cpus[p->cpu].asid_next) & ~asid_mask)
+		return;
+	if (p->cpu == this_cpu()->id)
+		invalidate_asid(p->asid & asid_mask);
+	else
+		tlb_shootdown(p->cpu, p->asid & asid_mask, -1UL);
+}
+void flush_tlb_page(struct process *p, unsigned long u_vaddr)
+{
+	if ((p->asid ^ cpus[p->cpu].asid_next) & ~asid_mask)
+		return;
+	if (p->cpu == this_cpu()->id)
+		invalidate_page(p->asid & asid_mask, u_vaddr);
+	else
+		tlb_shootdown(p->cpu, p->asid & asid_mask, u_vaddr);
+}
+void mem_init()
+{
+	unsigned long i, r, end, reserved_end;
+
+	if (VA_BITS > ((read_cpucfg(CPUCFG1) & CPUCFG1_VALEN) >> 12))
+		panic("panic: PT_LEVELS is too large for this cpu!\n");
+	nr_page = 0;
+	for (r = 0; r < sizeof(mem_regions) / sizeof(struct mem_region); r++)
+	{
+		if (!mem_regions[r].size)
+			continue;
+		end = (mem_regions[r].base + mem_regions[r].size) >> 12;
+		if (end > nr_page)
+			nr_page = end;
+	}
+	mem_map = (struct page *)(((unsigned long)_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL));
+	reserved_end = (((unsigned long)(mem_map + nr_page) & ~DMW_MASK) + PAGE_SIZE - 1) >> 12;
+	for (i = 0; i < nr_page; i++)
+	{
+		mem_map[i].order = 0;
+		mem_map[i].flags = PAGE_RESERVED;
+		mem_map[i].count = 0;
+		mem_map[i].used = 0;
+	}
+	for (r = 0; r < sizeof(mem_regions) / sizeof(struct mem_region); r++)
+	{
+		end = (mem_regions[r].base + mem_regions[r].size) >> 12;
+		for (i = mem_regions[r].base >> 12; i < end; i++)
+			if (i >= reserved_end)
+				mem_map[i].flags = 0;
+	}
+	asid_mask = (1UL << ((read_csr_32(CSR_ASID) & CSR_ASID_BITS) >> 16)) - 1;
+	mmu_init();
+}
+void mmu_init()
+{
+	this_cpu()->asid_next = asid_mask + 1;
 	write_csr_64(CSR_DMW0_PLV0 | DMW_MASK, CSR_DMW0);
 	write_csr_64(0, CSR_DMW3);
-	write_csr_64((PWCL_EWIDTH << 30) | (PWCL_PDWIDTH << 15) | (PWCL_PDBASE << 10) | (PWCL_PTWIDTH << 5) | (PWCL_PTBASE << 0), CSR_PWCL);
+	write_csr_64((PWCL_EWIDTH << 30) | (PWCL_DIR2WIDTH << 25) | (PWCL_DIR2BASE << 20) | (PWCL_PDWIDTH << 15) | (PWCL_PDBASE << 10) | (PWCL_PTWIDTH << 5) | (PWCL_PTBASE << 0), CSR_PWCL);
+	write_csr_64((PWCH_DIR3WIDTH << 6) | (PWCH_DIR3BASE << 0), CSR_PWCH);
 	invalidate();
 }
\ No newline at end of file
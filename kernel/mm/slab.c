@@ -0,0 +1,174 @@
+#include <xtos.h>
+
+#define NR_CACHE 16
+#define SLAB_MAX_ORDER 3
+#define SLAB_ALIGN 8
+
+struct slab
+{
+	struct slab *next, *prev;
+	struct kmem_cache *cache;
+	void *free;
+	int inuse;
+};
+
+struct kmem_cache caches[NR_CACHE];
+int nr_cache;
+
+void slab_list_add(struct slab **list, struct slab *slab)
+{
+	slab->prev = 0;
+	slab->next = *list;
+	if (*list)
+		(*list)->prev = slab;
+	*list = slab;
+}
+void slab_list_del(struct slab **list, struct slab *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		*list = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+}
+struct slab *new_slab(struct kmem_cache *cache)
+{
+	struct slab *slab;
+	char *obj;
+	int i;
+
+	slab = (struct slab *)get_page(1 << cache->order, 0);
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->free = 0;
+	obj = (char *)slab + cache->slab_offset + (cache->nr_objs - 1) * cache->stride;
+	for (i = 0; i < cache->nr_objs; i++, obj -= cache->stride)
+	{
+		if (cache->ctor)
+			cache->ctor(obj);
+		*(void **)(obj + cache->free_offset) = slab->free;
+		slab->free = obj;
+	}
+	cache->nr_slabs++;
+	return slab;
+}
+void free_slab(struct kmem_cache *cache, struct slab *slab)
+{
+	cache->nr_slabs--;
+	free_page((unsigned long)slab);
+}
+struct kmem_cache *kmem_cache_create(char *name, int size, int align, void (*ctor)(void *))
+{
+	struct kmem_cache *cache;
+	int order, slab_size;
+
+	if (align < SLAB_ALIGN)
+		align = SLAB_ALIGN;
+
+	if (nr_cache == NR_CACHE)
+		panic("panic: caches[] is full!\n");
+	cache = &caches[nr_cache++];
+	set_mem((char *)cache, 0, sizeof(struct kmem_cache));
+	cache->name = name;
+	cache->size = size;
+	cache->ctor = ctor;
+	cache->free_offset = ctor ? size : 0;
+	cache->stride = (size + (ctor ? sizeof(void *) : 0) + align - 1) & ~(align - 1);
+	if (cache->stride < sizeof(void *))
+		cache->stride = sizeof(void *);
+	cache->slab_offset = (sizeof(struct slab) + align - 1) & ~(align - 1);
+	for (order = 0; order <= SLAB_MAX_ORDER; order++)
+	{
+		slab_size = PAGE_SIZE << order;
+		cache->nr_objs = (slab_size - cache->slab_offset) / cache->stride;
+		if (cache->nr_objs && slab_size - cache->slab_offset - cache->nr_objs * cache->stride <= slab_size / 8)
+			break;
+	}
+	if (order > SLAB_MAX_ORDER)
+		order = SLAB_MAX_ORDER;
+	if (!cache->nr_objs)
+		panic("panic: object is too large for slab!\n");
+	cache->order = order;
+	return cache;
+}
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	struct slab *slab;
+	void *obj;
+
+	spin_lock(&cache->lock);
+	slab = cache->partial;
+	if (!slab)
+	{
+		slab = cache->empty;
+		if (slab)
+		{
+			slab_list_del(&cache->empty, slab);
+			cache->nr_empty--;
+		}
+		else
+		{
+			spin_unlock(&cache->lock);
+			slab = new_slab(cache);
+			spin_lock(&cache->lock);
+		}
+		slab_list_add(&cache->partial, slab);
+	}
+	obj = slab->free;
+	slab->free = *(void **)((char *)obj + cache->free_offset);
+	if (++slab->inuse == cache->nr_objs)
+	{
+		slab_list_del(&cache->partial, slab);
+		slab_list_add(&cache->full, slab);
+	}
+	cache->nr_active++;
+	cache->nr_alloc++;
+	spin_unlock(&cache->lock);
+	return obj;
+}
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct slab *slab;
+
+	slab = (struct slab *)((unsigned long)obj & ~((PAGE_SIZE << cache->order) - 1UL));
+	if (slab->cache != cache)
+		panic("panic: try to free object to wrong cache!\n");
+	spin_lock(&cache->lock);
+	*(void **)((char *)obj + cache->free_offset) = slab->free;
+	slab->free = obj;
+	if (slab->inuse-- == cache->nr_objs)
+	{
+		slab_list_del(&cache->full, slab);
+		slab_list_add(&cache->partial, slab);
+	}
+	if (slab->inuse == 0)
+	{
+		slab_list_del(&cache->partial, slab);
+		if (cache->nr_empty)
+			free_slab(cache, slab);
+		else
+		{
+			slab_list_add(&cache->empty, slab);
+			cache->nr_empty++;
+		}
+	}
+	cache->nr_active--;
+	cache->nr_free++;
+	spin_unlock(&cache->lock);
+}
+void slab_stats()
+{
+	struct kmem_cache *cache;
+	int i;
+
+	for (i = 0; i < nr_cache; i++)
+	{
+		cache = &caches[i];
+		printk(cache->name);
+		print_debug(" slabs: ", cache->nr_slabs);
+		print_debug(" active objects: ", cache->nr_active);
+		print_debug(" allocs: ", cache->nr_alloc);
+		print_debug(" frees: ", cache->nr_free);
+	}
+}
@@ -0,0 +1,156 @@
+#include <xtos.h>
+
+#define NR_SWAP_PAGE 2048
+#define SWAP_BATCH 32
+#define BLOCKS_PER_PAGE (PAGE_SIZE / BLOCK_SIZE)
+#define ENTRYS 512
+
+extern int nr_process;
+unsigned short swap_map[NR_SWAP_PAGE];
+int swap_hint;
+int swap_lock = 0;
+struct wait_queue swap_wait;
+int clock_pid;
+unsigned long clock_vaddr;
+unsigned long swap_victim[SWAP_BATCH];
+int swap_slot[SWAP_BATCH];
+int nr_victim;
+
+void lock_swap()
+{
+	while (swap_lock)
+		sleep_on_exclusive(&swap_wait);
+	swap_lock = 1;
+}
+void unlock_swap()
+{
+	swap_lock = 0;
+	wake_up(&swap_wait);
+}
+int get_swap_slot()
+{
+	int i, slot;
+
+	for (i = 0; i < NR_SWAP_PAGE; i++)
+	{
+		slot = (swap_hint + i) % NR_SWAP_PAGE;
+		if (swap_map[slot])
+			continue;
+		swap_map[slot] = 1;
+		swap_hint = slot + 1;
+		return slot;
+	}
+	return -1;
+}
+void dup_swap_entry(unsigned long entry)
+{
+	if (swap_map[entry >> 12] == (unsigned short)~0)
+		panic("panic: swap slot count overflow!\n");
+	swap_map[entry >> 12]++;
+}
+void free_swap_entry(unsigned long entry)
+{
+	if (!swap_map[entry >> 12])
+		panic("panic: try to free free swap slot!\n");
+	swap_map[entry >> 12]--;
+}
+void age_entry(struct process *p, unsigned long *entry, unsigned long u_vaddr)
+{
+	unsigned long page;
+	int slot;
+
+	if (*entry & PTE_SWAP)
+		return;
+	if (*entry & PTE_V)
+	{
+		*entry &= ~PTE_V;
+		flush_tlb_page(p, u_vaddr);
+		return;
+	}
+	page = (~0xfffUL & *entry) | DMW_MASK;
+	if (mem_map[(page & ~DMW_MASK) >> 12].count != 1)
+		return;
+	slot = get_swap_slot();
+	if (slot == -1)
+		return;
+	*entry = ((unsigned long)slot << 12) | (*entry & 0xfffUL) | PTE_SWAP;
+	swap_victim[nr_victim] = page;
+	swap_slot[nr_victim++] = slot;
+}
+void scan_table(struct process *p, unsigned long table, int level, unsigned long base)
+{
+	unsigned long *entry;
+	unsigned long size, u_vaddr;
+	int i;
+
+	size = 1UL << (12 + 9 * level);
+	entry = (unsigned long *)table;
+	for (i = 0; i < ENTRYS && nr_victim < SWAP_BATCH; i++, entry++)
+	{
+		u_vaddr = base + i * size;
+		if (!*entry || u_vaddr + size <= clock_vaddr)
+			continue;
+		if (level == 0)
+		{
+			clock_vaddr = u_vaddr + PAGE_SIZE;
+			age_entry(p, entry, u_vaddr);
+		}
+		else if (!(*entry & PTE_HUGE))
+			scan_table(p, *entry | DMW_MASK, level - 1, u_vaddr);
+	}
+}
+int reclaim_pages()
+{
+	struct process *p;
+	int i, nr;
+
+	lock_swap();
+	nr_victim = 0;
+	for (i = 0; i < 2 * nr_process && nr_victim < SWAP_BATCH; i++)
+	{
+		if (next_pid(clock_pid) != clock_pid)
+		{
+			clock_pid = next_pid(clock_pid);
+			clock_vaddr = 0;
+		}
+		p = find_process(clock_pid);
+		if (p && p->pid && p->state != TASK_EXIT)
+			scan_table(p, p->page_directory, PT_LEVELS - 1, 0);
+		if (nr_victim < SWAP_BATCH)
+		{
+			clock_pid++;
+			clock_vaddr = 0;
+		}
+	}
+	nr = nr_victim;
+	for (i = 0; i < nr; i++)
+	{
+		write_blocks(SWAP_START + swap_slot[i] * BLOCKS_PER_PAGE, (char *)swap_victim[i], BLOCKS_PER_PAGE);
+		free_page(swap_victim[i]);
+	}
+	unlock_swap();
+	return nr;
+}
+void do_swap_page(unsigned long *pte, unsigned long u_vaddr)
+{
+	unsigned long page, entry;
+
+	entry = *pte;
+	page = get_page(1, GFP_NOZERO);
+	lock_swap();
+	if (*pte != entry)
+	{
+		unlock_swap();
+		free_page(page);
+		return;
+	}
+	read_blocks(SWAP_START + (entry >> 12) * BLOCKS_PER_PAGE, (char *)page, BLOCKS_PER_PAGE);
+	unlock_swap();
+	free_swap_entry(entry);
+	*pte = (page & ~DMW_MASK) | (entry & 0xfffUL & ~PTE_SWAP) | PTE_V;
+	flush_tlb_page(current, u_vaddr);
+}
+void swap_stats()
+{
+	wait_queue_stats("swap lock", &swap_wait);
+}
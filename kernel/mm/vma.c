@@ -0,0 +1,183 @@
+#include <xtos.h>
+
+struct kmem_cache *vma_cache;
+
+struct vm_area *find_vma(struct process *p, unsigned long u_vaddr)
+{
+	struct vm_area *vma;
+
+	for (vma = p->mmap; vma; vma = vma->next)
+	{
+		if (u_vaddr < vma->start)
+			return 0;
+		if (u_vaddr < vma->end)
+			return vma;
+	}
+	return 0;
+}
+struct vm_area *insert_vma(struct process *p, unsigned long start, unsigned long end, unsigned long attr, struct inode *inode, unsigned long offset)
+{
+	struct vm_area *vma, **link;
+
+	vma = (struct vm_area *)kmem_cache_alloc(vma_cache);
+	vma->start = start;
+	vma->end = end;
+	vma->attr = attr;
+	vma->inode = inode;
+	vma->offset = offset;
+	vma->shm = 0;
+	vma->flags = 0;
+	for (link = &p->mmap; *link && (*link)->start < start; link = &(*link)->next)
+		;
+	vma->next = *link;
+	*link = vma;
+	return vma;
+}
+void copy_vmas(struct process *from, struct process *to)
+{
+	struct vm_area *vma, **link;
+
+	to->mmap = 0;
+	link = &to->mmap;
+	for (vma = from->mmap; vma; vma = vma->next)
+	{
+		*link = (struct vm_area *)kmem_cache_alloc(vma_cache);
+		copy_mem((char *)*link, (char *)vma, sizeof(struct vm_area));
+		if (vma->shm)
+			get_shm(vma->shm);
+		link = &(*link)->next;
+	}
+	*link = 0;
+}
+void release_vma(struct vm_area *vma)
+{
+	if (vma->shm)
+		put_shm(vma->shm);
+	kmem_cache_free(vma_cache, vma);
+}
+void free_vmas(struct process *p)
+{
+	struct vm_area *vma, *next;
+
+	for (vma = p->mmap; vma; vma = next)
+	{
+		next = vma->next;
+		release_vma(vma);
+	}
+	p->mmap = 0;
+}
+int map_area(struct process *p, unsigned long start, unsigned long end, unsigned long attr, int flags)
+{
+	struct vm_area *vma, *prev;
+
+	if (start >= end || end > VMEM_SIZE)
+		return -1;
+	prev = 0;
+	for (vma = p->mmap; vma && vma->start < end; vma = vma->next)
+	{
+		if (vma->end > start)
+			return -1;
+		prev = vma;
+	}
+	if (prev && prev->end == start && !prev->inode && !prev->shm && prev->attr == attr && prev->flags == flags)
+		prev->end = end;
+	else
+		insert_vma(p, start, end, attr, 0, 0)->flags = flags;
+	return 0;
+}
+void unmap_area(struct process *p, unsigned long start, unsigned long end)
+{
+	struct vm_area *vma, *tail, **link;
+
+	link = &p->mmap;
+	while ((vma = *link) && vma->start < end)
+	{
+		if (vma->end <= start)
+		{
+			link = &vma->next;
+			continue;
+		}
+		if (vma->start >= start && vma->end <= end)
+		{
+			*link = vma->next;
+			release_vma(vma);
+			continue;
+		}
+		if (vma->start < start && vma->end > end)
+		{
+			tail = (struct vm_area *)kmem_cache_alloc(vma_cache);
+			copy_mem((char *)tail, (char *)vma, sizeof(struct vm_area));
+			tail->start = end;
+			tail->offset += end - vma->start;
+			if (tail->shm)
+				get_shm(tail->shm);
+			vma->next = tail;
+			vma->end = start;
+		}
+		else if (vma->start < start)
+			vma->end = start;
+		else
+		{
+			vma->offset += end - vma->start;
+			vma->start = end;
+		}
+		link = &vma->next;
+	}
+	unmap_range(p, start, end);
+}
+unsigned long get_unmapped_area(struct process *p, unsigned long len, unsigned long align)
+{
+	struct vm_area *vma;
+	unsigned long addr, end, limit;
+
+	addr = 0;
+	end = PAGE_SIZE;
+	for (vma = p->mmap;; vma = vma->next)
+	{
+		limit = (vma && vma->start < MMAP_BASE) ? vma->start : MMAP_BASE;
+		if (limit >= end + len && ((limit - len) & ~(align - 1)) >= end)
+			addr = (limit - len) & ~(align - 1);
+		if (!vma || vma->start >= MMAP_BASE)
+			break;
+		end = vma->end;
+	}
+	return addr;
+}
+unsigned long sys_brk(unsigned long brk)
+{
+	unsigned long old_end, new_end;
+
+	if (brk < current->start_brk)
+		return current->brk;
+	old_end = (current->brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL);
+	new_end = (brk + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL);
+	if (new_end > old_end && map_area(current, old_end, new_end, PTE_PLV | PTE_W | PTE_D | PTE_V, 0))
+		return current->brk;
+	if (new_end < old_end)
+		unmap_area(current, new_end, old_end);
+	current->brk = brk;
+	return brk;
+}
+unsigned long sys_mmap(unsigned long len, int flags)
+{
+	unsigned long addr;
+
+	len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL);
+	if (!len || len >= MMAP_BASE)
+		return 0;
+	if (len < HUGE_PAGE_SIZE)
+		flags &= ~MAP_HUGE;
+	addr = get_unmapped_area(current, len, (flags & MAP_HUGE) ? HUGE_PAGE_SIZE : PAGE_SIZE);
+	if (!addr)
+		return 0;
+	map_area(current, addr, addr + len, PTE_PLV | PTE_W | PTE_D | PTE_V, (flags & MAP_HUGE) ? VM_HUGE : 0);
+	return addr;
+}
+int sys_munmap(unsigned long addr, unsigned long len)
+{
+	len = (len + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL);
+	if ((addr & (PAGE_SIZE - 1)) || !len || addr >= MMAP_BASE || len > MMAP_BASE - addr)
+		return -1;
+	unmap_area(current, addr, addr + len);
+	return 0;
+}
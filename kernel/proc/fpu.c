@@ -0,0 +1,99 @@
+#include <xtos.h>
+
+extern unsigned int simd_euen;
+struct kmem_cache *fpu_cache;
+
+void save_fp(struct fpu_state *);
+void restore_fp(struct fpu_state *);
+void save_lsx(struct fpu_state *);
+void restore_lsx(struct fpu_state *);
+void save_lasx(struct fpu_state *);
+void restore_lasx(struct fpu_state *);
+
+void save_fpu(struct process *p)
+{
+	write_csr_32(p->fpu_euen, CSR_EUEN);
+	if (p->fpu_euen & CSR_EUEN_ASXE)
+		save_lasx(p->fpu);
+	else if (p->fpu_euen & CSR_EUEN_SXE)
+		save_lsx(p->fpu);
+	else
+		save_fp(p->fpu);
+}
+void restore_fpu(struct process *p)
+{
+	write_csr_32(p->fpu_euen, CSR_EUEN);
+	if (p->fpu_euen & CSR_EUEN_ASXE)
+		restore_lasx(p->fpu);
+	else if (p->fpu_euen & CSR_EUEN_SXE)
+		restore_lsx(p->fpu);
+	else
+		restore_fp(p->fpu);
+}
+void release_fpu()
+{
+	struct cpu *cpu;
+
+	cpu = this_cpu();
+	if (!cpu->fpu_owner)
+		return;
+	save_fpu(cpu->fpu_owner);
+	cpu->fpu_owner = 0;
+	write_csr_32(0, CSR_EUEN);
+}
+void switch_fpu(struct process *next)
+{
+	write_csr_32(this_cpu()->fpu_owner == next ? next->fpu_euen : 0, CSR_EUEN);
+}
+void do_fpu_disabled(int ecode)
+{
+	struct cpu *cpu;
+	unsigned int euen;
+
+	euen = CSR_EUEN_FPE;
+	if (ecode == EXCP_SXD)
+		euen |= CSR_EUEN_SXE;
+	if (ecode == EXCP_ASXD)
+		euen |= CSR_EUEN_SXE | CSR_EUEN_ASXE;
+	if ((euen & simd_euen) != euen)
+	{
+		print_debug("simd unit not available: ", ecode);
+		sys_exit(-1);
+	}
+	cpu = this_cpu();
+	if (cpu->fpu_owner && cpu->fpu_owner != current)
+		release_fpu();
+	if (!current->fpu)
+	{
+		current->fpu = (struct fpu_state *)kmem_cache_alloc(fpu_cache);
+		set_mem((char *)current->fpu, 0, sizeof(struct fpu_state));
+	}
+	else if (cpu->fpu_owner == current)
+		save_fpu(current);
+	current->fpu_euen |= euen;
+	restore_fpu(current);
+	cpu->fpu_owner = current;
+}
+void copy_fpu(struct process *from, struct process *to)
+{
+	if (!from->fpu)
+		return;
+	if (this_cpu()->fpu_owner == from)
+		save_fpu(from);
+	to->fpu = (struct fpu_state *)kmem_cache_alloc(fpu_cache);
+	copy_mem((char *)to->fpu, (char *)from->fpu, sizeof(struct fpu_state));
+}
+void free_fpu(struct process *p)
+{
+	int i;
+
+	for (i = 0; i < NR_CPU; i++)
+		if (cpus[i].fpu_owner == p)
+			cpus[i].fpu_owner = 0;
+	if (this_cpu()->fpu_owner == 0)
+		write_csr_32(0, CSR_EUEN);
+	if (p->fpu)
+		kmem_cache_free(fpu_cache, p->fpu);
+	p->fpu = 0;
+	p->fpu_euen = 0;
+}
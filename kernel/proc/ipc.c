@@ -1,23 +1,272 @@
 #include <xtos.h>
 
-extern struct process *current;
-extern struct process *process[NR_PROCESS];
+#define NR_SHM 16
+#define NR_FUTEX 16
+#define SHM_MAX_PAGE (PAGE_SIZE / sizeof(unsigned long))
 
-void do_signal()
+struct shm
 {
+	int key;
+	int count;
+	int nr_page;
+	unsigned long *pages;
+};
+struct futex
+{
+	struct process *owner;
+	unsigned long key;
+	int nr_wait;
+	struct wait_queue wait;
+};
+
+extern struct process *init_task;
+struct shm shm_table[NR_SHM];
+struct futex futex_table[NR_FUTEX];
+
+void add_child(struct process *father, struct process *p)
+{
+	p->father = father;
+	p->sibling_prev = 0;
+	p->sibling_next = father->children;
+	if (father->children)
+		father->children->sibling_prev = p;
+	father->children = p;
+}
+void del_child(struct process *p)
+{
+	if (p->sibling_prev)
+		p->sibling_prev->sibling_next = p->sibling_next;
+	else
+		p->father->children = p->sibling_next;
+	if (p->sibling_next)
+		p->sibling_next->sibling_prev = p->sibling_prev;
+}
+void add_zombie(struct process *father, struct process *p)
+{
+	p->father = father;
+	p->sibling_next = father->zombies;
+	father->zombies = p;
+}
+void tell_father()
+{
+	struct process *p, *father, *init;
+
+	init = init_task;
+	father = current->father;
+	while ((p = current->children))
+	{
+		del_child(p);
+		add_child(init, p);
+	}
+	if (current->zombies)
+	{
+		while ((p = current->zombies))
+		{
+			current->zombies = p->sibling_next;
+			add_zombie(init, p);
+		}
+		if (father != init)
+			wake_process(init);
+	}
+	del_child(current);
+	add_zombie(father, current);
+	if (father->state == TASK_INTERRUPTIBLE)
+		wake_process(father);
+}
+int sys_wait(int pid, int *status)
+{
+	struct process **zp, *p;
+
+	if ((unsigned long)status >= VMEM_SIZE - sizeof(int))
+		return -1;
+	while (1)
+	{
+		for (zp = &current->zombies; (p = *zp); zp = &p->sibling_next)
+			if (pid == -1 || p->pid == pid)
+			{
+				if (status)
+					*status = p->exit_code;
+				*zp = p->sibling_next;
+				pid = p->pid;
+				free_process(p);
+				return pid;
+			}
+		for (p = current->children; p; p = p->sibling_next)
+			if (pid == -1 || p->pid == pid)
+				break;
+		if (!p)
+			return -1;
+		sys_pause();
+	}
+}
+struct shm *find_shm(int key)
+{
+	int i;
+
+	for (i = 0; i < NR_SHM; i++)
+		if (shm_table[i].count && shm_table[i].key == key)
+			return &shm_table[i];
+	return 0;
+}
+struct shm *create_shm(int key, int nr_page)
+{
+	struct shm *shm;
+	unsigned long *pages;
 	int i;
 
-	if (current->signal_exit)
+	pages = (unsigned long *)get_page(1, 0);
+	for (i = 0; i < nr_page; i++)
+		pages[i] = get_page(1, 0);
+	shm = find_shm(key);
+	if (!shm)
 	{
-		for (i = 1; i < NR_PROCESS; i++)
-			if (process[i] && process[i]->father == current && process[i]->state == TASK_EXIT)
-				free_process(process[i]);
-		current->signal_exit = 0;
+		for (i = 0; i < NR_SHM; i++)
+			if (!shm_table[i].count)
+				break;
+		if (i < NR_SHM)
+		{
+			shm = &shm_table[i];
+			shm->key = key;
+			shm->nr_page = nr_page;
+			shm->pages = pages;
+			return shm;
+		}
 	}
+	for (i = 0; i < nr_page; i++)
+		free_page(pages[i]);
+	free_page((unsigned long)pages);
+	return shm;
 }
-void tell_father()
+void get_shm(struct shm *shm)
+{
+	shm->count++;
+}
+void put_shm(struct shm *shm)
 {
-	current->father->signal_exit = 1;
-	if (current->father->state == TASK_INTERRUPTIBLE)
-		current->father->state = TASK_RUNNING;
+	int i;
+
+	if (--shm->count)
+		return;
+	for (i = 0; i < shm->nr_page; i++)
+		free_page(shm->pages[i]);
+	free_page((unsigned long)shm->pages);
+}
+unsigned long sys_shmat(int key, unsigned long size)
+{
+	struct shm *shm;
+	struct vm_area *vma;
+	unsigned long addr;
+	int i, nr_page;
+
+	nr_page = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+	if (!nr_page || nr_page > SHM_MAX_PAGE)
+		return 0;
+	shm = find_shm(key);
+	if (!shm)
+		shm = create_shm(key, nr_page);
+	if (!shm || shm->nr_page < nr_page)
+		return 0;
+	get_shm(shm);
+	addr = get_unmapped_area(current, nr_page * PAGE_SIZE, PAGE_SIZE);
+	if (!addr)
+	{
+		put_shm(shm);
+		return 0;
+	}
+	vma = insert_vma(current, addr, addr + nr_page * PAGE_SIZE, PTE_PLV | PTE_W | PTE_D | PTE_V, 0, 0);
+	vma->shm = shm;
+	for (i = 0; i < nr_page; i++)
+	{
+		share_page(shm->pages[i]);
+		put_page(current, addr + i * PAGE_SIZE, shm->pages[i], vma->attr | PTE_SHARED);
+	}
+	return addr;
+}
+int sys_shmdt(unsigned long addr)
+{
+	struct vm_area *vma;
+
+	vma = find_vma(current, addr);
+	if (!vma || !vma->shm || vma->start != addr)
+		return -1;
+	unmap_area(current, vma->start, vma->end);
+	return 0;
+}
+struct process *futex_key(int *addr, unsigned long *key)
+{
+	unsigned long *pte;
+
+	*(volatile int *)addr;
+	pte = find_pte(current, (unsigned long)addr);
+	if (pte && (*pte & PTE_SHARED) && !(*pte & PTE_HUGE))
+	{
+		*key = (*pte & ~0xfffUL) + ((unsigned long)addr & 0xfff);
+		return 0;
+	}
+	*key = (unsigned long)addr;
+	return current;
+}
+struct futex *find_futex(int *addr, int create)
+{
+	struct futex *free = 0;
+	struct process *owner;
+	unsigned long key;
+	int i;
+
+	owner = futex_key(addr, &key);
+	for (i = 0; i < NR_FUTEX; i++)
+	{
+		if (futex_table[i].nr_wait && futex_table[i].owner == owner && futex_table[i].key == key)
+			return &futex_table[i];
+		if (!futex_table[i].nr_wait && !free)
+			free = &futex_table[i];
+	}
+	if (!create || !free)
+		return 0;
+	free->owner = owner;
+	free->key = key;
+	return free;
+}
+int sys_futex_wait(int *addr, int val)
+{
+	struct futex *futex;
+
+	if ((unsigned long)addr >= VMEM_SIZE || ((unsigned long)addr & 3))
+		return -1;
+	if (*(volatile int *)addr != val)
+		return -1;
+	futex = find_futex(addr, 1);
+	if (!futex)
+		return -1;
+	futex->nr_wait++;
+	sleep_on_exclusive(&futex->wait);
+	futex->nr_wait--;
+	return 0;
+}
+int sys_futex_wake(int *addr, int nr)
+{
+	struct futex *futex;
+
+	if ((unsigned long)addr >= VMEM_SIZE || ((unsigned long)addr & 3))
+		return 0;
+	futex = find_futex(addr, 0);
+	if (!futex || nr <= 0)
+		return 0;
+	return __wake_up(&futex->wait, nr);
+}
+void futex_stats()
+{
+	struct wait_queue total;
+	int i;
+
+	set_mem((char *)&total, 0, sizeof(struct wait_queue));
+	for (i = 0; i < NR_FUTEX; i++)
+	{
+		total.nr_sleep += futex_table[i].wait.nr_sleep;
+		total.nr_wake += futex_table[i].wait.nr_wake;
+		total.wait_time += futex_table[i].wait.wait_time;
+		if (futex_table[i].wait.max_wait > total.max_wait)
+			total.max_wait = futex_table[i].wait.max_wait;
+	}
+	wait_queue_stats("futex", &total);
 }
@@ -0,0 +1,85 @@
+#include <xtos.h>
+
+#define PID_HASH 1024
+#define BITS_PER_LONG 64
+
+unsigned long pid_map[PID_MAX / BITS_PER_LONG];
+struct process *pid_hash[PID_HASH];
+int last_pid = -1;
+int nr_process;
+
+int alloc_pid()
+{
+	unsigned long free;
+	int i, pid, word;
+
+	pid = last_pid + 1;
+	for (i = 0; i <= PID_MAX / BITS_PER_LONG; i++)
+	{
+		if (pid >= PID_MAX)
+			pid = 1;
+		word = pid / BITS_PER_LONG;
+		free = ~pid_map[word] & (~0UL << (pid % BITS_PER_LONG));
+		if (free)
+		{
+			pid = word * BITS_PER_LONG + __builtin_ctzl(free);
+			pid_map[word] |= 1UL << (pid % BITS_PER_LONG);
+			last_pid = pid;
+			nr_process++;
+			return pid;
+		}
+		pid = (word + 1) * BITS_PER_LONG;
+	}
+	return -1;
+}
+void free_pid(int pid)
+{
+	pid_map[pid / BITS_PER_LONG] &= ~(1UL << (pid % BITS_PER_LONG));
+	nr_process--;
+}
+int next_pid(int pid)
+{
+	unsigned long used;
+	int word;
+
+	for (word = pid / BITS_PER_LONG; word < PID_MAX / BITS_PER_LONG; word++)
+	{
+		used = pid_map[word];
+		if (word == pid / BITS_PER_LONG)
+			used &= ~0UL << (pid % BITS_PER_LONG);
+		if (used)
+			return word * BITS_PER_LONG + __builtin_ctzl(used);
+	}
+	return 0;
+}
+void attach_pid(struct process *p)
+{
+	struct process **head;
+
+	head = &pid_hash[p->pid & (PID_HASH - 1)];
+	p->hash_next = *head;
+	*head = p;
+}
+void detach_pid(struct process *p)
+{
+	struct process **pp;
+
+	for (pp = &pid_hash[p->pid & (PID_HASH - 1)]; *pp; pp = &(*pp)->hash_next)
+		if (*pp == p)
+		{
+			*pp = p->hash_next;
+			break;
+		}
+	free_pid(p->pid);
+}
+struct process *find_process(int pid)
+{
+	struct process *p;
+
+	if (pid < 0 || pid >= PID_MAX)
+		return 0;
+	for (p = pid_hash[pid & (PID_HASH - 1)]; p; p = p->hash_next)
+		if (p->pid == pid)
+			return p;
+	return 0;
+}
@@ -1,11 +1,11 @@
 #include <xtos.h>
 
-#define CSR_PGDL 0x19
 #define CSR_SAVE0 0x30
-#define PROC_COUNTER 5
-#define PTE_V (1UL << 0)
-#define PTE_D (1UL << 1)
-#define PTE_PLV (3UL << 2)
+#define NR_LEVEL 4
+#define MIN_SLICE 2
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define NICE_STEP 10
 
 struct exe_xt
 {
@@ -13,172 +13,472 @@ struct exe_xt
 	int length;
 } __attribute__((packed));
 
-struct process *process[NR_PROCESS];
-struct process *current;
+struct process *init_task;
+struct kmem_cache *process_cache;
+extern struct kmem_cache *vma_cache;
+extern struct kmem_cache *fpu_cache;
 char proc0_code[] = {
-	0x0b, 0x00, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x80, 0x3c, 0x00, 0x44, 0x0b, 0x14, 0x80, 0x03,
-	0x00, 0x00, 0x2b, 0x00, 0x04, 0x00, 0x00, 0x1c, 0x84, 0x90, 0xc1, 0x28, 0x05, 0x00, 0x00, 0x1c,
-	0xa5, 0x90, 0xc1, 0x28, 0x0b, 0x18, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x04, 0x00, 0x00, 0x1c,
-	0x84, 0x70, 0xc1, 0x28, 0x0b, 0x08, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x0b, 0x0c, 0x80, 0x03,
-	0x00, 0x00, 0x2b, 0x00, 0x0b, 0x10, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0xff, 0xfb, 0xff, 0x53,
-	0x78, 0x74, 0x73, 0x68, 0x20, 0x64, 0x6f, 0x65, 0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x65, 0x78,
-	0x69, 0x73, 0x74, 0x21, 0x0a, 0x00, 0x78, 0x74, 0x73, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x6b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+	0x0b, 0x00, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x80, 0x40, 0x00, 0x44, 0x0b, 0x14, 0x80, 0x03,
+	0x00, 0x00, 0x2b, 0x00, 0x04, 0x00, 0x00, 0x1c, 0x84, 0xf0, 0xc1, 0x28, 0x05, 0x00, 0x00, 0x1c,
+	0xa5, 0xf0, 0xc1, 0x28, 0x0b, 0x48, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x80, 0x14, 0x00, 0x64,
+	0x04, 0x00, 0x00, 0x1c, 0x84, 0xc0, 0xc1, 0x28, 0x0b, 0x08, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00,
+	0x0b, 0x0c, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x0c, 0xfc, 0xbf, 0x02, 0x04, 0x30, 0x15, 0x00,
+	0x05, 0x00, 0x15, 0x00, 0x0b, 0x44, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0x80, 0xec, 0xff, 0x67,
+	0x0b, 0x10, 0x80, 0x03, 0x00, 0x00, 0x2b, 0x00, 0xff, 0xe3, 0xff, 0x53, 0x78, 0x74, 0x73, 0x68,
+	0x20, 0x64, 0x6f, 0x65, 0x73, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x65, 0x78, 0x69, 0x73, 0x74, 0x21,
+	0x0a, 0x00, 0x78, 0x74, 0x73, 0x68, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x82, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x87, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x6c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
+int task_prio(struct process *p)
+{
+	return p->level + (p->nice - NICE_MIN) / NICE_STEP;
+}
+int task_slice(struct process *p)
+{
+	return MIN_SLICE << p->level;
+}
+int select_cpu()
+{
+	int i, cpu;
+
+	cpu = current->cpu;
+	for (i = 0; i < NR_CPU; i++)
+		if (cpus[i].online && cpus[i].nr_running < cpus[cpu].nr_running)
+			cpu = i;
+	return cpu;
+}
+void setup_child(struct process *p, int pid)
+{
+	p->asid = 0;
+	p->ring_sq = 0;
+	p->ring_cq = 0;
+	p->context.ra = (unsigned long)fork_ret;
+	p->context.sp = p->kstack + PAGE_SIZE;
+	p->pid = pid;
+	attach_pid(p);
+	p->level = 0;
+	p->counter = task_slice(p);
+	p->utime = 0;
+	p->stime = 0;
+	p->children = 0;
+	p->zombies = 0;
+	add_child(current, p);
+	p->state = TASK_RUNNING;
+	p->cpu = select_cpu();
+	p->rq = 0;
+	activate_task(p);
+}
 int sys_fork()
 {
-	int i;
+	struct process *p;
+	int pid;
 
-	for (i = 1; i < NR_PROCESS; i++)
-		if (!process[i])
-			break;
-	if (i == NR_PROCESS)
-		panic("panic: process[] is empty!\n");
-	process[i] = (struct process *)get_page(1);
-	copy_mem((char *)process[i], (char *)current, PAGE_SIZE);
-	process[i]->page_directory = get_page(1);
-	copy_page_table(current, process[i]);
-	process[i]->context.ra = (unsigned long)fork_ret;
-	process[i]->context.sp = (unsigned long)process[i] + PAGE_SIZE;
-	process[i]->context.csr_save0 = read_csr_64(CSR_SAVE0);
-	process[i]->pid = i;
-	process[i]->counter = PROC_COUNTER;
-	process[i]->wait_next = 0;
-	process[i]->signal_exit = 0;
-	process[i]->father = current;
-	process[i]->state = TASK_RUNNING;
-	return i;
-}
-void put_exe_pages()
-{
-	unsigned long page = 0;
-	unsigned long size;
-
-	for (size = 0; size < current->exe_end; size += BLOCK_SIZE, page += BLOCK_SIZE)
-	{
-		if (size % PAGE_SIZE == 0)
-		{
-			page = get_page(1);
-			put_page(current, size, page, PTE_PLV | PTE_D | PTE_V);
-		}
-		read_inode_block(current->executable, size / BLOCK_SIZE + 1, (char *)page, BLOCK_SIZE);
-	}
+	pid = alloc_pid();
+	if (pid == -1)
+		return -1;
+	p = (struct process *)kmem_cache_alloc(process_cache);
+	copy_mem((char *)p, (char *)current, sizeof(struct process));
+	copy_fpu(current, p);
+	p->kstack = get_page(1, GFP_NOZERO);
+	copy_mem((char *)p->kstack, (char *)current->kstack, PAGE_SIZE);
+	p->page_directory = get_page(1, 0);
+	copy_page_table(current, p);
+	copy_vmas(current, p);
+	p->context.csr_save0 = read_csr_64(CSR_SAVE0);
+	setup_child(p, pid);
+	return pid;
 }
-int sys_exe(char *filename, char *arg)
+struct inode *open_exe(char *filename, struct exe_xt *exe)
+{
+	struct inode *inode;
+
+	inode = find_inode(filename);
+	if (!inode)
+		return 0;
+	read_inode_block(inode, 0, (char *)exe, sizeof(struct exe_xt));
+	if (exe->magic != 0x7478 || inode->type != 1)
+		return 0;
+	return inode;
+}
+void load_exe(struct process *p, struct inode *inode, int length, unsigned long arg_page)
+{
+	p->executable = inode;
+	p->exe_end = length;
+	p->start_brk = (p->exe_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1UL);
+	p->brk = p->start_brk;
+	put_page(p, VMEM_SIZE - PAGE_SIZE, arg_page, PTE_PLV | PTE_W | PTE_D | PTE_V);
+	insert_vma(p, 0, p->exe_end, PTE_PLV | PTE_W | PTE_D | PTE_V, inode, BLOCK_SIZE);
+	insert_vma(p, MMAP_BASE, VMEM_SIZE - PAGE_SIZE, PTE_PLV | PTE_W | PTE_D | PTE_V, 0, 0);
+}
+unsigned long sys_exe(char *filename, char *arg)
 {
 	struct inode *inode;
 	struct exe_xt exe;
 	unsigned long arg_page;
 
-	inode = find_inode(filename);
+	if ((unsigned long)filename >= VMEM_SIZE || (unsigned long)arg >= VMEM_SIZE)
+		return 0;
+	inode = open_exe(filename, &exe);
 	if (!inode)
 		return 0;
-	read_inode_block(inode, 0, (char *)&exe, sizeof(struct exe_xt));
-	if (exe.magic != 0x7478 || inode->type != 1)
-		panic("panic: the file is not executable!\n");
-	current->executable = inode;
-	current->exe_end = exe.length;
-	arg_page = get_page(1);
-	copy_string((char *)arg_page, arg);
+	arg_page = get_page(1, 0);
+	copy_string_user((char *)arg_page, arg, PAGE_SIZE);
+	free_fpu(current);
+	free_ring(current);
 	free_page_table(current);
-	put_page(current, VMEM_SIZE - PAGE_SIZE, arg_page, PTE_PLV | PTE_D | PTE_V);
-	put_exe_pages();
-	invalidate();
+	free_vmas(current);
+	load_exe(current, inode, exe.length, arg_page);
+	flush_tlb_mm(current);
 	return VMEM_SIZE - PAGE_SIZE;
 }
-int sys_exit()
+int sys_spawn(char *filename, char *arg)
+{
+	struct process *p;
+	struct inode *inode;
+	struct exe_xt exe;
+	unsigned long arg_page;
+	int pid;
+
+	if ((unsigned long)filename >= VMEM_SIZE || (unsigned long)arg >= VMEM_SIZE)
+		return -1;
+	inode = open_exe(filename, &exe);
+	if (!inode)
+		return -1;
+	pid = alloc_pid();
+	if (pid == -1)
+		return -1;
+	arg_page = get_page(1, 0);
+	copy_string_user((char *)arg_page, arg, PAGE_SIZE);
+	p = (struct process *)kmem_cache_alloc(process_cache);
+	copy_mem((char *)p, (char *)current, sizeof(struct process));
+	p->kstack = get_page(1, 0);
+	p->page_directory = get_page(1, 0);
+	p->mmap = 0;
+	p->fpu = 0;
+	p->fpu_euen = 0;
+	load_exe(p, inode, exe.length, arg_page);
+	p->context.csr_save0 = VMEM_SIZE - PAGE_SIZE;
+	setup_child(p, pid);
+	return pid;
+}
+int sys_nice(int inc)
 {
+	int nice;
+
+	if (inc < NICE_MIN - NICE_MAX)
+		inc = NICE_MIN - NICE_MAX;
+	if (inc > NICE_MAX - NICE_MIN)
+		inc = NICE_MAX - NICE_MIN;
+	nice = current->nice + inc;
+	if (nice < NICE_MIN)
+		nice = NICE_MIN;
+	if (nice > NICE_MAX)
+		nice = NICE_MAX;
+	current->nice = nice;
+	if (current->rq)
+	{
+		dequeue_task(current);
+		enqueue_task(current);
+	}
+	return nice;
+}
+int sys_times(unsigned long *times)
+{
+	if ((unsigned long)times > VMEM_SIZE - 2 * sizeof(unsigned long) || ((unsigned long)times & 7))
+		return -1;
+	times[0] = current->utime / cycles_per_tick;
+	times[1] = current->stime / cycles_per_tick;
+	return 0;
+}
+int sys_stats(int print)
+{
+	if (!print)
+		return nr_free_pages();
+	print_debug("free pages: ", nr_free_pages());
+	magazine_stats();
+	slab_stats();
+	disk_stats();
+	swap_stats();
+	con_stats();
+	futex_stats();
+	return nr_free_pages();
+}
+int sys_exit(int code)
+{
+	current->exit_code = code;
 	current->state = TASK_EXIT;
+	dequeue_task(current);
 	tell_father();
 	schedule();
 	return 0;
 }
 int sys_pause()
 {
+	if (current->pid == 0 && !zero_page_idle() && !this_cpu()->nr_running)
+		idle_cpu();
 	current->state = TASK_INTERRUPTIBLE;
+	dequeue_task(current);
 	schedule();
 	return 0;
 }
 void free_process(struct process *p)
 {
-	int pid;
-
-	pid = p->pid;
+	detach_pid(p);
+	free_fpu(p);
+	free_ring(p);
 	free_page_table(p);
+	free_vmas(p);
 	free_page(p->page_directory);
-	free_page((unsigned long)p);
-	process[pid] = 0;
+	free_page(p->kstack);
+	kmem_cache_free(process_cache, p);
+}
+void add_wait_entry(struct wait_queue *q, struct wait_entry *entry)
+{
+	entry->next = 0;
+	if (q->tail)
+		q->tail->next = entry;
+	else
+		q->head = entry;
+	q->tail = entry;
 }
-void sleep_on(struct process **p)
+void __sleep_on(struct wait_queue *q, int exclusive)
 {
+	struct wait_entry entry;
+	unsigned long start, wait;
+
+	entry.p = current;
+	entry.exclusive = exclusive;
+	start = get_cycles();
+	spin_lock(&q->lock);
+	add_wait_entry(q, &entry);
+	q->nr_sleep++;
 	current->state = TASK_UNINTERRUPTIBLE;
-	current->wait_next = *p;
-	*p = current;
+	spin_unlock(&q->lock);
+	dequeue_task(current);
 	schedule();
+	wait = get_cycles() - start;
+	spin_lock(&q->lock);
+	q->wait_time += wait;
+	if (wait > q->max_wait)
+		q->max_wait = wait;
+	spin_unlock(&q->lock);
+}
+void sleep_on(struct wait_queue *q)
+{
+	__sleep_on(q, 0);
 }
-void wake_up(struct process **p)
+void sleep_on_exclusive(struct wait_queue *q)
 {
-	struct process *first;
+	__sleep_on(q, 1);
+}
+int __wake_up(struct wait_queue *q, int nr_exclusive)
+{
+	struct wait_entry *entry;
+	int nr, exclusive;
 
-	first = *p;
-	if (!first)
+	nr = 0;
+	spin_lock(&q->lock);
+	while ((entry = q->head))
+	{
+		q->head = entry->next;
+		if (!q->head)
+			q->tail = 0;
+		q->nr_wake++;
+		exclusive = entry->exclusive;
+		wake_process(entry->p);
+		nr++;
+		if (exclusive && !--nr_exclusive)
+			break;
+	}
+	spin_unlock(&q->lock);
+	return nr;
+}
+void wake_up(struct wait_queue *q)
+{
+	__wake_up(q, 1);
+}
+void wake_up_all(struct wait_queue *q)
+{
+	__wake_up(q, 0);
+}
+void wait_queue_stats(char *name, struct wait_queue *q)
+{
+	printk(name);
+	print_debug(" sleeps: ", q->nr_sleep);
+	print_debug(" wakeups: ", q->nr_wake);
+	print_debug(" total wait: ", q->wait_time);
+	print_debug(" max wait: ", q->max_wait);
+}
+void wake_process(struct process *p)
+{
+	if (p->state == TASK_RUNNING)
 		return;
-	*p = first->wait_next;
-	first->wait_next = 0;
-	first->state = TASK_RUNNING;
+	p->state = TASK_RUNNING;
+	if (p->level)
+		p->level--;
+	activate_task(p);
 }
-void schedule()
+void activate_task(struct process *p)
 {
-	int pid = 0;
-	int i;
-	struct process *old;
+	struct cpu *cpu;
 
-	for (i = 1; i < NR_PROCESS; i++)
+	enqueue_task(p);
+	cpu = &cpus[p->cpu];
+	if (cpu->curr != cpu->idle && (p->rq != cpu->active || p->prio >= cpu->curr->prio))
+		return;
+	if (cpu == this_cpu())
+		cpu->need_resched = 1;
+	else
+		send_ipi(cpu->id, IPI_RESCHED);
+}
+void enqueue_task(struct process *p)
+{
+	struct cpu *cpu;
+	struct run_queue *rq;
+
+	if (p->pid == 0 || p->rq)
+		return;
+	cpu = &cpus[p->cpu];
+	spin_lock(&cpu->rq_lock);
+	rq = cpu->active;
+	if (!p->counter)
+	{
+		p->counter = task_slice(p);
+		rq = cpu->expired;
+	}
+	p->prio = task_prio(p);
+	p->rq = rq;
+	p->run_next = 0;
+	p->run_prev = rq->tail[p->prio];
+	if (p->run_prev)
+		p->run_prev->run_next = p;
+	else
+		rq->head[p->prio] = p;
+	rq->tail[p->prio] = p;
+	rq->bitmap |= 1U << p->prio;
+	cpu->nr_running++;
+	spin_unlock(&cpu->rq_lock);
+}
+void dequeue_task(struct process *p)
+{
+	struct cpu *cpu;
+	struct run_queue *rq;
+
+	rq = p->rq;
+	if (!rq)
+		return;
+	cpu = &cpus[p->cpu];
+	spin_lock(&cpu->rq_lock);
+	if (p->run_prev)
+		p->run_prev->run_next = p->run_next;
+	else
+		rq->head[p->prio] = p->run_next;
+	if (p->run_next)
+		p->run_next->run_prev = p->run_prev;
+	else
+		rq->tail[p->prio] = p->run_prev;
+	if (!rq->head[p->prio])
+		rq->bitmap &= ~(1U << p->prio);
+	p->rq = 0;
+	cpu->nr_running--;
+	spin_unlock(&cpu->rq_lock);
+}
+struct process *pick_next_task()
+{
+	struct cpu *cpu;
+	struct run_queue *rq;
+	struct process *next;
+
+	cpu = this_cpu();
+	spin_lock(&cpu->rq_lock);
+	if (!cpu->active->bitmap)
 	{
-		if (!process[i] || process[i]->state != TASK_RUNNING || process[i]->counter == 0)
-			continue;
-		pid = process[i]->pid;
-		break;
+		rq = cpu->active;
+		cpu->active = cpu->expired;
+		cpu->expired = rq;
 	}
-	if (i == NR_PROCESS)
+	if (!cpu->active->bitmap)
+		next = cpu->idle;
+	else
+		next = cpu->active->head[__builtin_ctz(cpu->active->bitmap)];
+	spin_unlock(&cpu->rq_lock);
+	return next;
+}
+void schedule()
+{
+	struct process *old, *next;
+
+	if (current->rq && !current->counter)
 	{
-		for (i = 0; i < NR_PROCESS; i++)
-		{
-			if (!process[i] || process[i]->state != TASK_RUNNING)
-				continue;
-			process[i]->counter = PROC_COUNTER;
-			pid = process[i]->pid;
-		}
+		dequeue_task(current);
+		if (current->level < NR_LEVEL - 1)
+			current->level++;
+		enqueue_task(current);
 	}
-	if (current->pid == pid)
+	next = pick_next_task();
+	switch_slice(current, next);
+	if (next == current)
 		return;
+	switch_fpu(next);
 	old = current;
-	current = process[pid];
-	write_csr_64(current->page_directory & ~DMW_MASK, CSR_PGDL);
-	invalidate();
+	current = next;
+	switch_mm(current);
 	swtch(&old->context, &current->context);
 }
+void idle_loop()
+{
+	while (1)
+	{
+		schedule();
+		if (!this_cpu()->nr_running)
+			idle_cpu();
+	}
+}
 void process_init()
 {
 	unsigned long page;
 	int i;
 
-	for (i = 0; i < NR_PROCESS; i++)
-		process[i] = 0;
-	process[0] = (struct process *)get_page(1);
-	write_csr_64((unsigned long)process[0] + PAGE_SIZE, CSR_SAVE0);
-	process[0]->page_directory = get_page(1);
-	write_csr_64(process[0]->page_directory & ~DMW_MASK, CSR_PGDL);
-	page = get_page(1);
+	process_cache = kmem_cache_create("process", sizeof(struct process), 0, 0);
+	vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, 0);
+	fpu_cache = kmem_cache_create("fpu_state", sizeof(struct fpu_state), FPU_ALIGN, 0);
+	for (i = 0; i < NR_CPU; i++)
+	{
+		cpus[i].id = i;
+		cpus[i].active = &cpus[i].queues[0];
+		cpus[i].expired = &cpus[i].queues[1];
+	}
+	init_task = (struct process *)kmem_cache_alloc(process_cache);
+	init_task->kstack = get_page(1, 0);
+	write_csr_64(init_task->kstack + PAGE_SIZE, CSR_SAVE0);
+	init_task->page_directory = get_page(1, 0);
+	init_task->asid = 0;
+	switch_mm(init_task);
+	page = get_page(1, 0);
 	copy_mem((void *)page, proc0_code, sizeof(proc0_code));
-	put_page(process[0], 0, page, PTE_PLV | PTE_D | PTE_V);
-	process[0]->pid = 0;
-	process[0]->exe_end = PAGE_SIZE;
-	process[0]->counter = PROC_COUNTER;
-	process[0]->wait_next = 0;
-	process[0]->signal_exit = 0;
-	process[0]->father = 0;
-	process[0]->state = TASK_RUNNING;
-	current = process[0];
+	put_page(init_task, 0, page, PTE_PLV | PTE_W | PTE_D | PTE_V);
+	init_task->pid = alloc_pid();
+	attach_pid(init_task);
+	init_task->exe_end = PAGE_SIZE;
+	init_task->mmap = 0;
+	init_task->nice = 0;
+	init_task->level = 0;
+	init_task->counter = task_slice(init_task);
+	init_task->utime = 0;
+	init_task->stime = 0;
+	init_task->father = 0;
+	init_task->children = 0;
+	init_task->zombies = 0;
+	init_task->state = TASK_RUNNING;
+	init_task->prio = task_prio(init_task);
+	init_task->rq = 0;
+	init_task->fpu = 0;
+	init_task->fpu_euen = 0;
+	init_task->ring_sq = 0;
+	init_task->ring_cq = 0;
+	init_task->cpu = 0;
+	cpus[0].idle = init_task;
+	cpus[0].online = 1;
+	current = init_task;
 }
\ No newline at end of file
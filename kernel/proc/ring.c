@@ -0,0 +1,127 @@
+#include <xtos.h>
+
+#define RING_ENTRIES 64
+#define RING_ARRAY 64
+#define RING_AGAIN -2
+
+struct ring_queue
+{
+	unsigned int head, tail, mask, entries;
+};
+struct ring_sqe
+{
+	unsigned int op;
+	unsigned int pad;
+	unsigned long addr, arg, user_data;
+};
+struct ring_cqe
+{
+	unsigned long user_data;
+	long res;
+};
+
+void init_ring_queue(unsigned long page)
+{
+	struct ring_queue *q;
+
+	q = (struct ring_queue *)page;
+	q->head = 0;
+	q->tail = 0;
+	q->mask = RING_ENTRIES - 1;
+	q->entries = RING_ENTRIES;
+}
+unsigned long sys_ring_setup()
+{
+	struct vm_area *vma;
+	unsigned long addr;
+
+	if (current->ring_sq)
+		return 0;
+	addr = get_unmapped_area(current, 2 * PAGE_SIZE, PAGE_SIZE);
+	if (!addr)
+		return 0;
+	current->ring_sq = get_page(1, 0);
+	current->ring_cq = get_page(1, 0);
+	init_ring_queue(current->ring_sq);
+	init_ring_queue(current->ring_cq);
+	vma = insert_vma(current, addr, addr + 2 * PAGE_SIZE, PTE_PLV | PTE_W | PTE_D | PTE_V, 0, 0);
+	share_page(current->ring_sq);
+	share_page(current->ring_cq);
+	put_page(current, addr, current->ring_sq, vma->attr | PTE_SHARED);
+	put_page(current, addr + PAGE_SIZE, current->ring_cq, vma->attr | PTE_SHARED);
+	return addr;
+}
+void free_ring(struct process *p)
+{
+	if (!p->ring_sq)
+		return;
+	free_page(p->ring_sq);
+	free_page(p->ring_cq);
+	p->ring_sq = 0;
+	p->ring_cq = 0;
+}
+long ring_read_block(char *buf, unsigned long blocknr)
+{
+	char *block;
+
+	if (blocknr >= SWAP_START)
+		return -1;
+	block = kmem_cache_alloc(buffer_cache);
+	copy_mem(block, read_block(blocknr), BLOCK_SIZE);
+	copy_user(buf, block, BLOCK_SIZE);
+	kmem_cache_free(buffer_cache, block);
+	return BLOCK_SIZE;
+}
+long ring_op(struct ring_sqe *sqe, int block)
+{
+	if (sqe->addr >= VMEM_SIZE)
+		return -1;
+	switch (sqe->op)
+	{
+	case RING_OP_OUTPUT:
+		return sys_output((char *)sqe->addr);
+	case RING_OP_INPUT:
+		if (con_read((char *)sqe->addr, !block))
+			return RING_AGAIN;
+		return 0;
+	case RING_OP_READ:
+		if (sqe->addr > VMEM_SIZE - BLOCK_SIZE)
+			return -1;
+		return ring_read_block((char *)sqe->addr, sqe->arg);
+	case RING_OP_SPAWN:
+		return sys_spawn((char *)sqe->addr, (char *)sqe->arg);
+	}
+	return -1;
+}
+// 按用户提交的顺序同步执行，只有读键盘会睡眠：
+// 完成队列里的未取项少于wait_nr时等到按键，否则该项留在队头并提前返回
+int sys_ring_enter(int to_submit, int wait_nr)
+{
+	struct ring_queue *sq, *cq;
+	struct ring_sqe sqe;
+	struct ring_cqe *cqe;
+	long res;
+	int nr;
+
+	if (!current->ring_sq)
+		return -1;
+	sq = (struct ring_queue *)current->ring_sq;
+	cq = (struct ring_queue *)current->ring_cq;
+	for (nr = 0; nr < to_submit; nr++)
+	{
+		if (sq->head == __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE))
+			break;
+		if (cq->tail - __atomic_load_n(&cq->head, __ATOMIC_ACQUIRE) == RING_ENTRIES)
+			break;
+		sqe = ((struct ring_sqe *)(current->ring_sq + RING_ARRAY))[sq->head & (RING_ENTRIES - 1)];
+		res = ring_op(&sqe, cq->tail - cq->head < wait_nr);
+		if (res == RING_AGAIN)
+			break;
+		cqe = &((struct ring_cqe *)(current->ring_cq + RING_ARRAY))[cq->tail & (RING_ENTRIES - 1)];
+		cqe->user_data = sqe.user_data;
+		cqe->res = res;
+		__atomic_store_n(&cq->tail, cq->tail + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&sq->head, sq->head + 1, __ATOMIC_RELEASE);
+	}
+	return nr;
+}
@@ -1,6 +1,7 @@
 #!/bin/bash
 
 debug=$1
+mem=2048
 if [[ "$debug" == "-d" ]];then
 	debug="-s -S"
 fi
@@ -10,14 +11,14 @@ rm -f kernel xtfs.img
 
 cd ../kernel 
 make clean
-make  
+make MEMORY_SIZE=$((mem << 20))
 mv kernel ../run
 make clean
 cd ../xtfs
 ./init_img.sh
 cd ../run 
 
-../../cross-tool/qemu-system-loongarch64 -vga std -m 2G -smp 1 \
+../../cross-tool/qemu-system-loongarch64 -vga std -m ${mem}M -smp 4 \
 -bios ../../cross-tool/loongarch_bios_0310_debug.bin \
 -kernel kernel \
 -drive format=raw,id=xtfs,file=xtfs.img,if=none \
@@ -5,6 +5,41 @@
 #define NR_pause 4
 #define NR_mount 5
 #define NR_exe 6
+#define NR_brk 7
+#define NR_mmap 8
+#define NR_munmap 9
+#define NR_shmat 10
+#define NR_shmdt 11
+#define NR_futex_wait 12
+#define NR_futex_wake 13
+#define NR_nice 14
+#define NR_times 15
+#define NR_sleep 16
+#define NR_wait 17
+#define NR_spawn 18
+#define NR_ring_setup 19
+#define NR_ring_enter 20
+#define NR_stats 21
+
+#define MAP_HUGE 0x1
+
+#define RING_HEAD 0
+#define RING_TAIL 4
+#define RING_MASK 8
+#define RING_ENTRIES 12
+#define RING_ARRAY 64
+#define RING_SQE_SIZE 32
+#define RING_SQE_OP 0
+#define RING_SQE_ADDR 8
+#define RING_SQE_ARG 16
+#define RING_SQE_USER_DATA 24
+#define RING_CQE_SIZE 16
+#define RING_CQE_USER_DATA 0
+#define RING_CQE_RES 8
+#define RING_OP_OUTPUT 0
+#define RING_OP_INPUT 1
+#define RING_OP_READ 2
+#define RING_OP_SPAWN 3
 
 .macro syscall0 A7
 	ori $a7, $r0, \A7
@@ -32,3 +67,9 @@
 	ori $a7, $r0, \A7
 	syscall 0
 .endm
+.macro syscall2_rr A7, A0, A1
+	or $a0, $r0, \A0
+	or $a1, $r0, \A1
+	ori $a7, $r0, \A7
+	syscall 0
+.endm
@@ -3,12 +3,14 @@
 cd bin
 ./compile.sh xtsh 
 ./compile.sh print
+./compile.sh bench
 
-dd if=/dev/zero of=xtfs.img bs=512 count=4096 2> /dev/null
+dd if=/dev/zero of=xtfs.img bs=512 count=20480 2> /dev/null
 ../format 
 ../copy xtsh 1
 ../copy print 1
+../copy bench 1
 
-rm -f xtsh print
+rm -f xtsh print bench
 mv xtfs.img ../../run
 cd ../